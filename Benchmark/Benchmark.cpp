@@ -0,0 +1,186 @@
+//Benchmark sweep of every kernel over image sizes, bit depths, bin counts, work group sizes and kernel variants,
+//reported as CSV or JSON (median and 95th percentile time, bytes, pixels/s, GB/s and the fraction of the peak bandwidth measured
+//with stream_copy) to pick configurations and catch regressions. A summary of the best run of every kernel against the peak goes to stderr.
+#include <iostream>
+#include <vector>
+#include "Utils.h"
+#include "Benchmark.h"
+#include "Compare.h"
+
+void print_help() {
+	std::cerr << "Application usage:" << std::endl;
+
+	std::cerr << "  -p : select platform " << std::endl;
+	std::cerr << "  -d : select device" << std::endl;
+	std::cerr << "  -l : list all platforms and devices" << std::endl;
+	std::cerr << "  -f : PNM image to include, can be given more than once (default: the images of Tutorial 2)" << std::endl;
+	std::cerr << "  --sizes : synthetic image sizes in megapixels, comma separated (default: 1,16, up to 200 or more)" << std::endl;
+	std::cerr << "  --dist : distributions of the synthetic images, uniform, gaussian, constant, bimodal or natural (default: uniform,constant)" << std::endl;
+	std::cerr << "  --bits : bit depths of the synthetic images (default: 8,16)" << std::endl;
+	std::cerr << "  --bins : bin counts (default: 16,256,4096, larger than the bit depth allows are skipped)" << std::endl;
+	std::cerr << "  --wg : work group sizes (default: powers of two up to the kernel limit)" << std::endl;
+	std::cerr << "  --ppi : pixels per work item of the histogram kernels (default: 1,16)" << std::endl;
+	std::cerr << "  -r : timed repeats per configuration (default: 20)" << std::endl;
+	std::cerr << "  --csv file : write the results as CSV (default: CSV on stdout)" << std::endl;
+	std::cerr << "  --json file : write the results as JSON" << std::endl;
+	std::cerr << "  --compare baseline.json : compare against an earlier --json run, exits with 2 if a kernel got slower or a configuration of the baseline is missing (run it with the same options)" << std::endl;
+	std::cerr << "  --threshold : slowdown that counts as a regression for --compare, 0.05 = 5% (default: 0.05)" << std::endl;
+	std::cerr << "  -h : print this message" << std::endl;
+}
+
+//"1,16,200" -> { 1, 16, 200 }
+template <typename T>
+vector<T> ParseList(const string& text) {
+	vector<T> values;
+	stringstream sstream(text);
+	string item;
+	while (getline(sstream, item, ',')) {
+		if (!item.empty())
+			values.push_back((T)atof(item.c_str()));
+	}
+	return values;
+}
+
+int main(int argc, char** argv) {
+	int platform_id = 0;
+	int device_id = 0;
+	vector<string> image_filenames;
+	vector<double> sizes = { 1, 16 };
+	vector<int> bit_depths = { 8, 16 };
+	vector<Distribution> distributions = { Distribution::Uniform, Distribution::Constant };
+	BenchmarkOptions options;
+	string csv_filename, json_filename, baseline_filename;
+	CompareOptions compare_options;
+
+	for (int i = 1; i < argc; i++) {
+		if ((strcmp(argv[i], "-p") == 0) && (i < (argc - 1))) { platform_id = atoi(argv[++i]); }
+		else if ((strcmp(argv[i], "-d") == 0) && (i < (argc - 1))) { device_id = atoi(argv[++i]); }
+		else if (strcmp(argv[i], "-l") == 0) { std::cout << ListPlatformsDevices() << std::endl; }
+		else if ((strcmp(argv[i], "-f") == 0) && (i < (argc - 1))) { image_filenames.push_back(argv[++i]); }
+		else if ((strcmp(argv[i], "--sizes") == 0) && (i < (argc - 1))) { sizes = ParseList<double>(argv[++i]); }
+		else if ((strcmp(argv[i], "--dist") == 0) && (i < (argc - 1))) {
+			distributions.clear();
+			stringstream sstream(argv[++i]);
+			string name;
+			while (getline(sstream, name, ',')) {
+				Distribution distribution;
+				if (!ParseDistribution(name, distribution)) {
+					std::cerr << "Unknown distribution " << name << std::endl;
+					return 1;
+				}
+				distributions.push_back(distribution);
+			}
+		}
+		else if ((strcmp(argv[i], "--bits") == 0) && (i < (argc - 1))) { bit_depths = ParseList<int>(argv[++i]); }
+		else if ((strcmp(argv[i], "--bins") == 0) && (i < (argc - 1))) { options.nr_bins = ParseList<int>(argv[++i]); }
+		else if ((strcmp(argv[i], "--wg") == 0) && (i < (argc - 1))) { options.work_group_sizes = ParseList<size_t>(argv[++i]); }
+		else if ((strcmp(argv[i], "--ppi") == 0) && (i < (argc - 1))) { options.pixels_per_item = ParseList<cl_uint>(argv[++i]); }
+		else if ((strcmp(argv[i], "-r") == 0) && (i < (argc - 1))) { options.repeats = max(1, atoi(argv[++i])); }
+		else if ((strcmp(argv[i], "--csv") == 0) && (i < (argc - 1))) { csv_filename = argv[++i]; }
+		else if ((strcmp(argv[i], "--json") == 0) && (i < (argc - 1))) { json_filename = argv[++i]; }
+		else if ((strcmp(argv[i], "--compare") == 0) && (i < (argc - 1))) { baseline_filename = argv[++i]; }
+		else if ((strcmp(argv[i], "--threshold") == 0) && (i < (argc - 1))) { compare_options.threshold = atof(argv[++i]); }
+		else if (strcmp(argv[i], "-h") == 0) { print_help(); return 0; }
+	}
+
+	//the images of Tutorial 2, from the repository root or from the project folder (Visual Studio runs it there)
+	if (image_filenames.empty()) {
+		for (const string& name : { "test.pgm", "test.ppm", "test_large.ppm" }) {
+			for (const string& folder : { "Tutorial 2/images/", "../Tutorial 2/images/" }) {
+				if (ifstream(folder + name).is_open()) {
+					image_filenames.push_back(folder + name);
+					break;
+				}
+			}
+		}
+	}
+
+	//read the baseline before the sweep, a bad file should not cost a whole run
+	string baseline_device;
+	vector<BenchmarkResult> baseline;
+	if (!baseline_filename.empty() && !ReadJsonResults(baseline_filename, baseline_device, baseline))
+		return 1;
+
+	cimg::exception_mode(0);
+
+	try {
+		cl::Context context = GetContext(platform_id, device_id);
+		cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+		DeviceCaps caps = ProbeDevice(device);
+		cl_ulong max_alloc_size = device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+		std::cerr << "Running on " << GetPlatformName(platform_id) << ", " << GetDeviceName(platform_id, device_id) << std::endl;
+
+		vector<BenchmarkImage> images;
+		for (const string& file_name : image_filenames)
+			images.push_back(LoadBenchmarkImage(file_name));
+		for (int bit_depth : bit_depths) {
+			for (double megapixels : sizes) {
+				size_t side = (size_t)sqrt(megapixels * 1e6);
+				size_t bytes = side * side * (bit_depth > 8 ? 2 : 1);
+				if (bytes > max_alloc_size) {
+					std::cerr << "Skipping " << megapixels << " MP at " << bit_depth << " bits, larger than the biggest buffer of the device" << std::endl;
+					continue;
+				}
+				for (Distribution distribution : distributions)
+					images.push_back(MakeBenchmarkImage(side, side, bit_depth, distribution));
+			}
+		}
+
+		//one program per bit depth, since the pixel type is a build option
+		cl::Program::Sources sources;
+		AddKernelSources(sources);
+		map<int, cl::Program> programs;
+
+		//peak bandwidth first, with the program of the first bit depth (stream_copy does not depend on it)
+		vector<BenchmarkResult> results;
+		int first_bit_depth = images.empty() ? 8 : images[0].bit_depth;
+		programs[first_bit_depth] = BuildKernelProgram(context, device, caps, first_bit_depth, sources);
+		results.push_back(BenchmarkPeakBandwidth(context, device, programs[first_bit_depth], options.repeats));
+		double peak_gb_per_s = GetPeakGigabytesPerSecond(results.back());
+
+		for (const BenchmarkImage& image : images) {
+			if (programs.count(image.bit_depth) == 0)
+				programs[image.bit_depth] = BuildKernelProgram(context, device, caps, image.bit_depth, sources);
+			for (int nr_bins : options.nr_bins) {
+				if (nr_bins < 1 || nr_bins > (1 << image.bit_depth))
+					continue;
+				std::cerr << image.name << ", " << nr_bins << " bins" << std::endl;
+				vector<BenchmarkResult> kernel_results = BenchmarkKernels(context, device, programs[image.bit_depth], caps, image, nr_bins, options);
+				results.insert(results.end(), kernel_results.begin(), kernel_results.end());
+				if (image.bit_depth > 8)
+					results.push_back(BenchmarkEndToEnd<unsigned short>(context, image, nr_bins, options.repeats));
+				else
+					results.push_back(BenchmarkEndToEnd<unsigned char>(context, image, nr_bins, options.repeats));
+			}
+		}
+
+		if (!csv_filename.empty()) {
+			ofstream file(csv_filename);
+			WriteCsv(file, results, peak_gb_per_s);
+		}
+		if (!json_filename.empty()) {
+			ofstream file(json_filename);
+			WriteJson(file, caps.name, results, peak_gb_per_s);
+		}
+		if (csv_filename.empty() && json_filename.empty() && baseline_filename.empty())
+			WriteCsv(std::cout, results, peak_gb_per_s);
+		WriteRooflineSummary(std::cerr, results, peak_gb_per_s);
+
+		if (!baseline_filename.empty()) {
+			if (baseline_device != caps.name)
+				std::cerr << "Warning: the baseline was run on " << baseline_device << std::endl;
+			if (CompareResults(std::cout, baseline, results, compare_options) > 0)
+				return 2;
+		}
+	}
+	catch (const cl::Error& err) {
+		std::cerr << "ERROR: " << err.what() << ", " << getErrorString(err.err()) << std::endl;
+		return 1;
+	}
+	catch (CImgException& err) {
+		std::cerr << "ERROR: " << err.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,471 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include "Utils.h"
+#include "CImg.h"
+#include "Tuning.h"
+#include "Dispatch.h"
+#include "Pipeline.h"
+#include "ImageIO.h"
+#include "ImageGenerator.h"
+#include "Timing.h"
+#include "HistogramEqualizer.h"
+
+//One image of the sweep, pixels are kept as raw bytes (1 byte per value up to 8 bits, 2 above) with the channels one after another
+struct BenchmarkImage {
+	string name;
+	size_t width = 0;
+	size_t height = 0;
+	int channels = 1;
+	int bit_depth = 8;
+	vector<unsigned char> data;
+
+	size_t PixelSize() const { return bit_depth > 8 ? 2 : 1; }
+	size_t ChannelSize() const { return width * height; }
+	size_t Bytes() const { return data.size(); }
+};
+
+//One row of the report, times in ns over the repeats of a single configuration
+struct BenchmarkResult {
+	string image;
+	size_t width = 0;
+	size_t height = 0;
+	int channels = 1;
+	int bit_depth = 8;
+	int nr_bins = 0;
+	string kernel; //kernel name, or end_to_end for the whole equalisation through HistogramEqualizer (upload to download)
+	size_t work_group_size = 0;
+	cl_uint pixels_per_item = 1;
+	double median_ns = 0;
+	double p95_ns = 0;
+	double best_ns = 0;
+	vector<double> times_ns; //every timed repeat, for the confidence intervals of --compare
+	double bytes_read = 0; //global memory the kernel has to touch at least once (end_to_end: the upload and the download)
+	double bytes_written = 0;
+	double pixels = 0; //pixels of the image the kernel goes through, 0 for the kernels that work on the bins
+
+	double GigabytesPerSecond() const { return median_ns > 0 ? (bytes_read + bytes_written) / median_ns : 0; }
+	double PixelsPerSecond() const { return median_ns > 0 ? pixels * 1e9 / median_ns : 0; }
+	//Fraction of the stream_copy bandwidth of the device, close to 1 means memory bound. Not given for end_to_end,
+	//whose bytes go over the host link and not through device memory.
+	double PeakFraction(double peak_gb_per_s) const { return (peak_gb_per_s > 0 && kernel != "end_to_end") ? GigabytesPerSecond() / peak_gb_per_s : 0; }
+};
+
+//Settings of the sweep, every combination that makes sense for an image is run
+struct BenchmarkOptions {
+	vector<int> nr_bins = { 16, 256, 4096 };
+	vector<size_t> work_group_sizes; //empty: powers of two up to the kernel limit
+	vector<cl_uint> pixels_per_item = { 1, 16 };
+	int repeats = 20;
+	size_t batch_images = 64; //histogram_batched and lut_apply_batched run on the image cut into this many small images
+};
+
+//Nearest rank percentile, p in [0, 100]
+inline double Percentile(vector<double> values, double p) {
+	if (values.empty())
+		return 0;
+	sort(values.begin(), values.end());
+	size_t rank = (size_t)ceil(p / 100.0 * values.size());
+	return values[min(values.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+inline double GetEventTime(const cl::Event& event) {
+	return (double)(event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>());
+}
+
+template <typename T>
+BenchmarkImage ToBenchmarkImage(const CImg<T>& input, const string& name, int bit_depth) {
+	BenchmarkImage image;
+	image.name = name;
+	image.bit_depth = bit_depth;
+	image.width = input.width();
+	image.height = (size_t)input.height() * input.depth();
+	image.channels = input.spectrum();
+	image.data.assign((const unsigned char*)input.data(), (const unsigned char*)(input.data() + input.size()));
+	return image;
+}
+
+//Synthetic mono image from ImageGenerator.h, named after its distribution, size and bit depth
+inline BenchmarkImage MakeBenchmarkImage(size_t width, size_t height, int bit_depth, Distribution distribution) {
+	string name = string(GetDistributionName(distribution)) + "_" + to_string(width) + "x" + to_string(height) + "_" + to_string(bit_depth) + "bit";
+	if (bit_depth > 8)
+		return ToBenchmarkImage(GenerateImage<unsigned short>(width, height, 1, bit_depth, distribution), name, bit_depth);
+	return ToBenchmarkImage(GenerateImage<unsigned char>(width, height, 1, bit_depth, distribution), name, bit_depth);
+}
+
+//A PNM file like the ones in Tutorial 2/images, at the bit depth of its header
+inline BenchmarkImage LoadBenchmarkImage(const string& file_name) {
+	int max_pixel_value = GetPnmMaxValue(file_name);
+	int bit_depth = GetBitDepth(max_pixel_value);
+	string name = file_name.substr(file_name.find_last_of("/\\") + 1);
+	if (bit_depth > 8)
+		return ToBenchmarkImage(ReadImage<unsigned short>(file_name, max_pixel_value), name, bit_depth);
+	return ToBenchmarkImage(ReadImage<unsigned char>(file_name, max_pixel_value), name, bit_depth);
+}
+
+//Runs enqueue() repeats times after one warm up run and fills in the median and 95th percentile of the event times.
+//Settings the device rejects (e.g. CL_INVALID_WORK_GROUP_SIZE) return false and are left out of the report.
+inline bool TimeKernel(BenchmarkResult& result, int repeats, const std::function<cl::Event()>& enqueue) {
+	try {
+		enqueue().wait();
+		vector<double> times;
+		for (int i = 0; i < repeats; i++) {
+			cl::Event event = enqueue();
+			event.wait();
+			times.push_back(GetEventTime(event));
+		}
+		result.median_ns = Percentile(times, 50);
+		result.p95_ns = Percentile(times, 95);
+		result.best_ns = Percentile(times, 0);
+		result.times_ns = times;
+		return true;
+	}
+	catch (const cl::Error&) {
+		return false;
+	}
+}
+
+//Every histogram, scan and LUT kernel (batched ones included) that can run this image and bin count on the device, over the work group sizes of the sweep.
+//The program has to be built for the bit depth of the image.
+inline vector<BenchmarkResult> BenchmarkKernels(const cl::Context& context, const cl::Device& device, const cl::Program& program, const DeviceCaps& caps,
+	const BenchmarkImage& image, int nr_bins, const BenchmarkOptions& options) {
+	cl::CommandQueue queue(context, device, CL_QUEUE_PROFILING_ENABLE);
+	const int channels = image.channels;
+	const size_t channel_size = image.ChannelSize();
+	const size_t levels = (size_t)1 << image.bit_depth;
+	const size_t histogram_bytes = sizeof(cl_uint) * nr_bins * channels;
+	cl_uint bin_mul, bin_shift;
+	GetBinMapping(nr_bins, image.bit_depth, bin_mul, bin_shift);
+
+	cl::Buffer dev_image(context, CL_MEM_READ_ONLY, image.Bytes());
+	cl::Buffer dev_output(context, CL_MEM_WRITE_ONLY, image.Bytes());
+	cl::Buffer dev_histogram(context, CL_MEM_READ_WRITE, histogram_bytes);
+	cl::Buffer dev_cumulative_histogram(context, CL_MEM_READ_WRITE, histogram_bytes);
+	cl::Buffer dev_lut(context, CL_MEM_READ_WRITE, image.PixelSize() * levels * channels);
+	queue.enqueueWriteBuffer(dev_image, CL_TRUE, 0, image.Bytes(), image.data.data());
+	queue.enqueueFillBuffer(dev_histogram, (cl_uint)0, 0, histogram_bytes);
+
+	BenchmarkResult row;
+	row.image = image.name;
+	row.width = image.width;
+	row.height = image.height;
+	row.channels = channels;
+	row.bit_depth = image.bit_depth;
+	row.nr_bins = nr_bins;
+
+	auto work_group_sizes = [&](const cl::Kernel& kernel) {
+		size_t limit = min(caps.max_work_group_size, kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+		if (options.work_group_sizes.empty())
+			return GetWorkGroupCandidates(limit);
+		vector<size_t> sizes;
+		for (size_t size : options.work_group_sizes) {
+			if (size <= limit)
+				sizes.push_back(size);
+		}
+		return sizes;
+	};
+
+	vector<BenchmarkResult> results;
+	bool bins_fit_local = histogram_bytes / channels <= caps.local_mem_size;
+	vector<string> histogram_kernels = { "histogram_global" };
+	if (bins_fit_local)
+		histogram_kernels.push_back("histogram_local");
+	if (nr_bins <= PRIVATE_BINS)
+		histogram_kernels.push_back("histogram_private");
+	if (bins_fit_local && caps.subgroups)
+		histogram_kernels.push_back("histogram_subgroup");
+
+	//the histogram is accumulated with atomics, it is not cleared between repeats since only the time matters here
+	for (const string& name : histogram_kernels) {
+		cl::Kernel kernel(program, name.c_str());
+		for (size_t work_group_size : work_group_sizes(kernel)) {
+			for (cl_uint pixels_per_item : options.pixels_per_item) {
+				LaunchConfig config;
+				config.work_group_size = work_group_size;
+				config.pixels_per_item = pixels_per_item;
+				BenchmarkResult result = row;
+				result.kernel = name;
+				result.work_group_size = work_group_size;
+				result.pixels_per_item = pixels_per_item;
+				result.bytes_read = (double)image.Bytes();
+				result.bytes_written = (double)histogram_bytes;
+				result.pixels = (double)channel_size * channels;
+				if (TimeKernel(result, options.repeats, [&]() {
+					return EnqueueHistogram(queue, kernel, name, dev_image, dev_histogram, channel_size, channels, nr_bins, bin_mul, bin_shift, config);
+				}))
+					results.push_back(result);
+			}
+		}
+	}
+
+	vector<string> scan_kernels = { "scan_blocked" };
+	if ((size_t)nr_bins <= caps.max_work_group_size && sizeof(cl_uint) * nr_bins <= caps.local_mem_size)
+		scan_kernels.push_back("scan_local");
+	for (const string& name : scan_kernels) {
+		cl::Kernel kernel(program, name.c_str());
+		vector<size_t> sizes = name == "scan_local" ? vector<size_t>{ (size_t)nr_bins } : work_group_sizes(kernel);
+		for (size_t work_group_size : sizes) {
+			LaunchConfig config;
+			config.work_group_size = work_group_size;
+			BenchmarkResult result = row;
+			result.kernel = name;
+			result.work_group_size = work_group_size;
+			result.bytes_read = (double)histogram_bytes;
+			result.bytes_written = (double)histogram_bytes;
+			if (TimeKernel(result, options.repeats, [&]() {
+				return EnqueueScan(queue, kernel, dev_histogram, dev_cumulative_histogram, channels, nr_bins, config);
+			}))
+				results.push_back(result);
+		}
+	}
+
+	{
+		cl::Kernel kernel(program, "lut_build");
+		BenchmarkResult result = row;
+		result.kernel = "lut_build";
+		result.bytes_read = (double)histogram_bytes;
+		result.bytes_written = (double)levels * channels * image.PixelSize();
+		if (TimeKernel(result, options.repeats, [&]() {
+			return EnqueueLutBuild(queue, kernel, dev_cumulative_histogram, dev_lut, channels, nr_bins, levels, bin_mul, bin_shift);
+		}))
+			results.push_back(result);
+	}
+	{
+		//timed is lut_build_reciprocal, lut_reciprocal before it is one work item per channel
+		cl::Kernel reciprocal_kernel(program, "lut_reciprocal");
+		cl::Kernel kernel(program, "lut_build_reciprocal");
+		cl::Buffer dev_reciprocals(context, CL_MEM_READ_WRITE, sizeof(cl_ulong) * 4 * channels);
+		BenchmarkResult result = row;
+		result.kernel = "lut_build_reciprocal";
+		result.bytes_read = (double)histogram_bytes;
+		result.bytes_written = (double)levels * channels * image.PixelSize();
+		if (TimeKernel(result, options.repeats, [&]() {
+			return EnqueueLutBuildReciprocal(queue, reciprocal_kernel, kernel, dev_cumulative_histogram, dev_reciprocals, dev_lut, channels, nr_bins, levels, bin_mul, bin_shift);
+		}))
+			results.push_back(result);
+	}
+
+	for (const string& name : { string("lut_apply"), string("lut_apply_vec") }) {
+		cl::Kernel kernel(program, name.c_str());
+		for (size_t work_group_size : work_group_sizes(kernel)) {
+			LaunchConfig config;
+			config.work_group_size = work_group_size;
+			BenchmarkResult result = row;
+			result.kernel = name;
+			result.work_group_size = work_group_size;
+			result.pixels_per_item = name == "lut_apply_vec" ? 4 : 1;
+			result.bytes_read = (double)image.Bytes(); //the LUT itself stays in the caches
+			result.bytes_written = (double)image.Bytes();
+			result.pixels = (double)channel_size * channels;
+			if (TimeKernel(result, options.repeats, [&]() {
+				return EnqueueLut(queue, kernel, name, dev_image, dev_output, dev_lut, channel_size, channels, levels, config);
+			}))
+				results.push_back(result);
+		}
+	}
+
+	//lut_apply_image on the channels stacked into one single component image, the LUT read as a 1D image on top of dev_lut.
+	//The copy into the input image is done once and not timed.
+	if (caps.image_support) {
+		try {
+			const cl::ImageFormat image_format = GetLutImageFormat(image.bit_depth);
+			const size_t rows = image.height * channels;
+			cl::Image2D dev_input_image(context, CL_MEM_READ_ONLY, image_format, image.width, rows);
+			cl::Image2D dev_output_image(context, CL_MEM_WRITE_ONLY, image_format, image.width, rows);
+			cl::Image1DBuffer dev_lut_image(context, CL_MEM_READ_ONLY, image_format, levels * channels, dev_lut);
+			queue.enqueueCopyBufferToImage(dev_image, dev_input_image, 0, { 0, 0, 0 }, { image.width, rows, 1 });
+			cl::Kernel kernel(program, "lut_apply_image");
+			for (size_t work_group_size : work_group_sizes(kernel)) {
+				LaunchConfig config;
+				config.work_group_size = work_group_size;
+				BenchmarkResult result = row;
+				result.kernel = "lut_apply_image";
+				result.work_group_size = work_group_size;
+				result.pixels_per_item = 1;
+				result.bytes_read = (double)image.Bytes();
+				result.bytes_written = (double)image.Bytes();
+				result.pixels = (double)channel_size * channels;
+				if (TimeKernel(result, options.repeats, [&]() {
+					return EnqueueLutImage(queue, kernel, dev_input_image, dev_output_image, dev_lut_image, image.width, image.height, channels, levels, config);
+				}))
+					results.push_back(result);
+			}
+		}
+		catch (const cl::Error& err) {
+			//e.g. CL_IMAGE_FORMAT_NOT_SUPPORTED or an image over the size limits of the device
+			std::cerr << "lut_apply_image skipped: " << err.what() << ", " << getErrorString(err.err()) << std::endl;
+		}
+	}
+
+	//the batched kernels on the image cut into batch_images equal parts (the last one takes the rest), each part read as a small
+	//image with the same number of channels. One histogram and one LUT per slice, the LUT is not initialised since only the time matters.
+	const size_t batch_images = max((size_t)1, min(options.batch_images, channel_size));
+	if (sizeof(cl_uint) * nr_bins <= caps.local_mem_size) {
+		const size_t part = channel_size / batch_images * channels;
+		vector<cl_uint> offsets;
+		for (size_t i = 0; i < batch_images; i++)
+			offsets.push_back((cl_uint)(i * part));
+		offsets.push_back((cl_uint)(channel_size * channels));
+		const size_t max_channel_size = (offsets[batch_images] - offsets[batch_images - 1]) / channels;
+		const size_t slices = batch_images * channels;
+		const size_t batch_histogram_bytes = sizeof(cl_uint) * nr_bins * slices;
+		const size_t batch_lut_bytes = image.PixelSize() * levels * slices;
+		cl::Buffer dev_offsets(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(cl_uint) * offsets.size(), offsets.data());
+		cl::Buffer dev_batch_histogram(context, CL_MEM_READ_WRITE, batch_histogram_bytes);
+		cl::Buffer dev_batch_lut(context, CL_MEM_READ_ONLY, batch_lut_bytes);
+		queue.enqueueFillBuffer(dev_batch_histogram, (cl_uint)0, 0, batch_histogram_bytes);
+		for (const string& name : { string("histogram_batched"), string("lut_apply_batched") }) {
+			cl::Kernel kernel(program, name.c_str());
+			for (size_t work_group_size : work_group_sizes(kernel)) {
+				for (cl_uint pixels_per_item : options.pixels_per_item) {
+					LaunchConfig config;
+					config.work_group_size = work_group_size;
+					config.pixels_per_item = pixels_per_item;
+					BenchmarkResult result = row;
+					result.kernel = name;
+					result.work_group_size = work_group_size;
+					result.pixels_per_item = pixels_per_item;
+					result.bytes_read = (double)image.Bytes();
+					result.bytes_written = name == "histogram_batched" ? (double)batch_histogram_bytes : (double)image.Bytes();
+					result.pixels = (double)channel_size * channels;
+					if (TimeKernel(result, options.repeats, [&]() {
+						if (name == "histogram_batched")
+							return EnqueueHistogramBatched(queue, kernel, dev_image, dev_offsets, dev_batch_histogram, slices, channels, nr_bins, bin_mul, bin_shift, max_channel_size, config);
+						return EnqueueLutBatched(queue, kernel, dev_image, dev_output, dev_offsets, dev_batch_lut, slices, channels, levels, max_channel_size, config);
+					}))
+						results.push_back(result);
+				}
+			}
+		}
+	}
+	return results;
+}
+
+//The whole equalisation as a library user sees it (upload, kernels picked by the dispatcher with tuned settings, download),
+//timed on the host. Settings come from the device's tuning file, anything missing is tuned first (the file is left alone)
+//and the first call is not counted.
+template <typename T>
+BenchmarkResult BenchmarkEndToEnd(const cl::Context& context, const BenchmarkImage& image, int nr_bins, int repeats) {
+	EqualizerFormat format;
+	format.width = image.width;
+	format.height = image.height;
+	format.channels = image.channels;
+	format.bit_depth = image.bit_depth;
+	format.nr_bins = nr_bins;
+	EqualizerOptions options;
+	options.tuning_file = GetTuningFileName(context.getInfo<CL_CONTEXT_DEVICES>()[0]);
+	HistogramEqualizer<T> equalizer(context, format, options);
+
+	Span<const T> input(reinterpret_cast<const T*>(image.data.data()), image.data.size() / sizeof(T));
+	vector<T> output(input.size);
+	equalizer.tune(input);
+	equalizer.equalize(input, output);
+
+	vector<double> times;
+	for (int i = 0; i < repeats; i++) {
+		auto start = chrono::steady_clock::now();
+		equalizer.equalize(input, output);
+		times.push_back((double)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+	}
+
+	BenchmarkResult result;
+	result.image = image.name;
+	result.width = image.width;
+	result.height = image.height;
+	result.channels = image.channels;
+	result.bit_depth = image.bit_depth;
+	result.nr_bins = nr_bins;
+	result.kernel = "end_to_end";
+	result.work_group_size = equalizer.histogram_config().work_group_size;
+	result.pixels_per_item = equalizer.histogram_config().pixels_per_item;
+	result.median_ns = Percentile(times, 50);
+	result.p95_ns = Percentile(times, 95);
+	result.best_ns = Percentile(times, 0);
+	result.times_ns = times;
+	result.bytes_read = (double)image.Bytes();
+	result.bytes_written = (double)image.Bytes();
+	result.pixels = (double)image.ChannelSize() * image.channels;
+	return result;
+}
+
+//Peak bandwidth of the device from stream_copy over two buffers of up to 256 MB (less if the device cannot allocate that much),
+//like the copy test of STREAM. The result row has the best run in best_ns, the peak is taken from it since a copy never beats the hardware.
+inline BenchmarkResult BenchmarkPeakBandwidth(const cl::Context& context, const cl::Device& device, const cl::Program& program, int repeats) {
+	cl::CommandQueue queue(context, device, CL_QUEUE_PROFILING_ENABLE);
+	cl_ulong bytes = min((cl_ulong)256 << 20, min(device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>(), device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>() / 4));
+	bytes -= bytes % 16;
+	cl::Buffer input(context, CL_MEM_READ_ONLY, bytes);
+	cl::Buffer output(context, CL_MEM_WRITE_ONLY, bytes);
+	queue.enqueueFillBuffer(input, (cl_uint)0, 0, bytes);
+
+	cl::Kernel kernel(program, "stream_copy");
+	kernel.setArg(0, input);
+	kernel.setArg(1, output);
+	kernel.setArg(2, (cl_uint)(bytes / 16));
+
+	BenchmarkResult result;
+	result.image = "copy_" + to_string(bytes >> 20) + "MB";
+	result.kernel = "stream_copy";
+	result.bytes_read = (double)bytes;
+	result.bytes_written = (double)bytes;
+	if (!TimeKernel(result, repeats, [&]() {
+		cl::Event event;
+		queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(bytes / 16), cl::NullRange, NULL, &event);
+		return event;
+	}))
+		std::cerr << "stream_copy failed, no peak bandwidth to compare against" << std::endl;
+	return result;
+}
+
+inline double GetPeakGigabytesPerSecond(const BenchmarkResult& copy) {
+	return copy.best_ns > 0 ? (copy.bytes_read + copy.bytes_written) / copy.best_ns : 0;
+}
+
+//Best configuration of every kernel over the whole sweep against the peak bandwidth. Kernels far below the peak even at their best
+//are held back by something else than memory, for the histogram kernels that is the atomics.
+inline void WriteRooflineSummary(ostream& out, const vector<BenchmarkResult>& results, double peak_gb_per_s) {
+	map<string, const BenchmarkResult*> best;
+	for (const BenchmarkResult& result : results) {
+		const BenchmarkResult*& current = best[result.kernel];
+		if (!current || result.PeakFraction(peak_gb_per_s) > current->PeakFraction(peak_gb_per_s))
+			current = &result;
+	}
+	out << "Peak bandwidth (stream_copy): " << peak_gb_per_s << " GB/s" << endl;
+	for (const auto& kernel : best) {
+		const BenchmarkResult& result = *kernel.second;
+		if (result.kernel == "end_to_end" || result.kernel == "stream_copy")
+			continue;
+		double fraction = result.PeakFraction(peak_gb_per_s);
+		char line[200];
+		snprintf(line, sizeof(line), "  %-20s %8.1f GB/s  %5.1f%% of peak  %-22s (%s, %d bins, wg %zu)", result.kernel.c_str(), result.GigabytesPerSecond(),
+			fraction * 100, fraction >= 0.6 ? "memory bound" : "not memory bound", result.image.c_str(), result.nr_bins, result.work_group_size);
+		out << line << endl;
+	}
+}
+
+inline void WriteCsv(ostream& out, const vector<BenchmarkResult>& results, double peak_gb_per_s) {
+	out << "image,width,height,channels,bit_depth,nr_bins,kernel,work_group_size,pixels_per_item,median_ns,p95_ns,bytes_read,bytes_written,mpixels_per_s,gb_per_s,peak_fraction\n";
+	for (const BenchmarkResult& result : results) {
+		out << result.image << "," << result.width << "," << result.height << "," << result.channels << "," << result.bit_depth << ","
+			<< result.nr_bins << "," << result.kernel << "," << result.work_group_size << "," << result.pixels_per_item << ","
+			<< result.median_ns << "," << result.p95_ns << "," << result.bytes_read << "," << result.bytes_written << ","
+			<< result.PixelsPerSecond() / 1e6 << "," << result.GigabytesPerSecond() << "," << result.PeakFraction(peak_gb_per_s) << "\n";
+	}
+}
+
+inline void WriteJson(ostream& out, const string& device_name, const vector<BenchmarkResult>& results, double peak_gb_per_s) {
+	out << "{\n  \"device\": " << JsonString(device_name) << ",\n  \"peak_gb_per_s\": " << peak_gb_per_s << ",\n  \"results\": [";
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchmarkResult& result = results[i];
+		out << (i == 0 ? "\n" : ",\n") << "    { \"image\": " << JsonString(result.image) << ", \"width\": " << result.width << ", \"height\": " << result.height
+			<< ", \"channels\": " << result.channels << ", \"bit_depth\": " << result.bit_depth << ", \"nr_bins\": " << result.nr_bins
+			<< ", \"kernel\": " << JsonString(result.kernel) << ", \"work_group_size\": " << result.work_group_size << ", \"pixels_per_item\": " << result.pixels_per_item
+			<< ", \"median_ns\": " << result.median_ns << ", \"p95_ns\": " << result.p95_ns << ", \"bytes_read\": " << result.bytes_read << ", \"bytes_written\": " << result.bytes_written
+			<< ", \"mpixels_per_s\": " << result.PixelsPerSecond() / 1e6 << ", \"gb_per_s\": " << result.GigabytesPerSecond() << ", \"peak_fraction\": " << result.PeakFraction(peak_gb_per_s) << ", \"times_ns\": [";
+		for (size_t j = 0; j < result.times_ns.size(); j++)
+			out << (j == 0 ? "" : ", ") << result.times_ns[j];
+		out << "] }";
+	}
+	out << "\n  ]\n}\n";
+}
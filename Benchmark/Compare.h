@@ -0,0 +1,252 @@
+#pragma once
+
+#include <random>
+#include <map>
+#include "Benchmark.h"
+
+//Regression check of a benchmark run against a stored baseline (the JSON of an earlier --json run). Configurations are matched by
+//image, bin count, kernel and launch settings, and for every pair the ratio of the median times gets a bootstrap confidence interval
+//from the timed repeats of both runs. A kernel only counts as slower when the whole interval is above 1 + threshold, so a noisy
+//configuration with an interval across the threshold is not flagged.
+
+//Just enough JSON for the files WriteJson writes: objects, arrays, strings, numbers, true/false/null
+struct JsonValue {
+	enum Type { Null, Bool, Number, String, Array, Object } type = Null;
+	double number = 0;
+	string text;
+	vector<JsonValue> items;
+	map<string, JsonValue> members;
+
+	const JsonValue& operator[](const string& key) const {
+		static const JsonValue null_value;
+		auto member = members.find(key);
+		return member != members.end() ? member->second : null_value;
+	}
+};
+
+class JsonReader {
+public:
+	explicit JsonReader(const string& text) : text_(text) {}
+
+	//false (with the position) if the text is not valid JSON
+	bool Parse(JsonValue& value) {
+		if (!ParseValue(value)) {
+			std::cerr << "Invalid JSON at offset " << pos_ << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+private:
+	void SkipSpace() {
+		while (pos_ < text_.size() && isspace((unsigned char)text_[pos_]))
+			pos_++;
+	}
+
+	bool ParseString(string& out) {
+		if (text_[pos_] != '"')
+			return false;
+		for (pos_++; pos_ < text_.size(); pos_++) {
+			char c = text_[pos_];
+			if (c == '"') {
+				pos_++;
+				return true;
+			}
+			if (c == '\\' && pos_ + 1 < text_.size())
+				c = text_[++pos_]; //only \" and \\ are written, others keep the escaped character
+			out += c;
+		}
+		return false;
+	}
+
+	bool ParseValue(JsonValue& value) {
+		SkipSpace();
+		if (pos_ >= text_.size())
+			return false;
+		char c = text_[pos_];
+		if (c == '{') {
+			value.type = JsonValue::Object;
+			pos_++;
+			SkipSpace();
+			if (pos_ < text_.size() && text_[pos_] == '}') {
+				pos_++;
+				return true;
+			}
+			while (true) {
+				SkipSpace();
+				string key;
+				if (pos_ >= text_.size() || !ParseString(key))
+					return false;
+				SkipSpace();
+				if (pos_ >= text_.size() || text_[pos_++] != ':')
+					return false;
+				if (!ParseValue(value.members[key]))
+					return false;
+				SkipSpace();
+				if (pos_ < text_.size() && text_[pos_] == ',') { pos_++; continue; }
+				if (pos_ < text_.size() && text_[pos_] == '}') { pos_++; return true; }
+				return false;
+			}
+		}
+		if (c == '[') {
+			value.type = JsonValue::Array;
+			pos_++;
+			SkipSpace();
+			if (pos_ < text_.size() && text_[pos_] == ']') {
+				pos_++;
+				return true;
+			}
+			while (true) {
+				value.items.emplace_back();
+				if (!ParseValue(value.items.back()))
+					return false;
+				SkipSpace();
+				if (pos_ < text_.size() && text_[pos_] == ',') { pos_++; continue; }
+				if (pos_ < text_.size() && text_[pos_] == ']') { pos_++; return true; }
+				return false;
+			}
+		}
+		if (c == '"') {
+			value.type = JsonValue::String;
+			return ParseString(value.text);
+		}
+		for (const char* word : { "true", "false", "null" }) {
+			if (text_.compare(pos_, strlen(word), word) == 0) {
+				value.type = word[0] == 'n' ? JsonValue::Null : JsonValue::Bool;
+				value.number = word[0] == 't' ? 1 : 0;
+				pos_ += strlen(word);
+				return true;
+			}
+		}
+		char* end = NULL;
+		value.type = JsonValue::Number;
+		value.number = strtod(text_.c_str() + pos_, &end);
+		if (end == text_.c_str() + pos_)
+			return false;
+		pos_ = end - text_.c_str();
+		return true;
+	}
+
+	const string& text_;
+	size_t pos_ = 0;
+};
+
+//Results of a --json file, with the timed repeats if the file has them (files from before times_ns only have the median)
+inline bool ReadJsonResults(const string& file_name, string& device_name, vector<BenchmarkResult>& results) {
+	ifstream file(file_name);
+	if (!file.is_open()) {
+		std::cerr << "Unable to open " << file_name << std::endl;
+		return false;
+	}
+	string text((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+	JsonValue root;
+	if (!JsonReader(text).Parse(root))
+		return false;
+	if (root["results"].type != JsonValue::Array) {
+		std::cerr << file_name << " has no results" << std::endl;
+		return false;
+	}
+
+	device_name = root["device"].text;
+	for (const JsonValue& item : root["results"].items) {
+		BenchmarkResult result;
+		result.image = item["image"].text;
+		result.width = (size_t)item["width"].number;
+		result.height = (size_t)item["height"].number;
+		result.channels = (int)item["channels"].number;
+		result.bit_depth = (int)item["bit_depth"].number;
+		result.nr_bins = (int)item["nr_bins"].number;
+		result.kernel = item["kernel"].text;
+		result.work_group_size = (size_t)item["work_group_size"].number;
+		result.pixels_per_item = (cl_uint)item["pixels_per_item"].number;
+		result.median_ns = item["median_ns"].number;
+		result.p95_ns = item["p95_ns"].number;
+		for (const JsonValue& time : item["times_ns"].items)
+			result.times_ns.push_back(time.number);
+		if (result.times_ns.empty())
+			result.times_ns.push_back(result.median_ns);
+		results.push_back(result);
+	}
+	return true;
+}
+
+//Configuration a result belongs to, the same in both runs
+inline string GetResultKey(const BenchmarkResult& result) {
+	return result.image + "/" + to_string(result.width) + "x" + to_string(result.height) + "x" + to_string(result.channels) + "/" + to_string(result.bit_depth)
+		+ "bit/" + to_string(result.nr_bins) + "bins/" + result.kernel + "/wg" + to_string(result.work_group_size) + "/ppi" + to_string(result.pixels_per_item);
+}
+
+//95% bootstrap interval of median(current) / median(baseline), resampling both sets of times with replacement.
+//Fixed seed, so the same two files always give the same verdict.
+inline void BootstrapMedianRatio(const vector<double>& baseline, const vector<double>& current, int resamples, double& low, double& high) {
+	mt19937 generator(1);
+	uniform_int_distribution<size_t> pick_baseline(0, baseline.size() - 1), pick_current(0, current.size() - 1);
+	vector<double> ratios, baseline_sample(baseline.size()), current_sample(current.size());
+	for (int r = 0; r < resamples; r++) {
+		for (double& time : baseline_sample)
+			time = baseline[pick_baseline(generator)];
+		for (double& time : current_sample)
+			time = current[pick_current(generator)];
+		double baseline_median = Percentile(baseline_sample, 50);
+		if (baseline_median > 0)
+			ratios.push_back(Percentile(current_sample, 50) / baseline_median);
+	}
+	low = Percentile(ratios, 2.5);
+	high = Percentile(ratios, 97.5);
+}
+
+struct CompareOptions {
+	double threshold = 0.05; //slowdown that counts, 0.05 = 5% slower
+	int resamples = 2000;
+};
+
+//Prints every configuration whose interval is entirely above 1 + threshold (regression) or below 1 - threshold (improvement),
+//and every configuration of the baseline the current run does not have (e.g. a kernel that stopped launching, which the sweep
+//leaves out). Returns the number of regressions plus missing configurations. stream_copy is left out, it measures the machine
+//and not our kernels.
+inline int CompareResults(ostream& out, const vector<BenchmarkResult>& baseline, const vector<BenchmarkResult>& current, const CompareOptions& options) {
+	map<string, const BenchmarkResult*> baseline_results, current_results;
+	for (const BenchmarkResult& result : baseline)
+		baseline_results[GetResultKey(result)] = &result;
+	for (const BenchmarkResult& result : current)
+		current_results[GetResultKey(result)] = &result;
+
+	int regressions = 0, improvements = 0, compared = 0, added = 0, missing = 0;
+	for (const BenchmarkResult& result : baseline) {
+		if (result.kernel == "stream_copy" || current_results.count(GetResultKey(result)) > 0)
+			continue;
+		missing++;
+		char line[300];
+		snprintf(line, sizeof(line), "%-11s %-70s %10.0f ns in the baseline, not in this run", "MISSING", GetResultKey(result).c_str(), result.median_ns);
+		out << line << endl;
+	}
+	for (const BenchmarkResult& result : current) {
+		if (result.kernel == "stream_copy")
+			continue;
+		auto match = baseline_results.find(GetResultKey(result));
+		if (match == baseline_results.end()) {
+			added++;
+			continue;
+		}
+		compared++;
+		double low, high;
+		BootstrapMedianRatio(match->second->times_ns, result.times_ns, options.resamples, low, high);
+		bool regression = low > 1 + options.threshold;
+		bool improvement = high < 1 - options.threshold;
+		if (!regression && !improvement)
+			continue;
+		(regression ? regressions : improvements)++;
+		char line[300];
+		snprintf(line, sizeof(line), "%-11s %-70s %10.0f -> %10.0f ns  x%.3f [%.3f, %.3f]", regression ? "REGRESSION" : "improvement", GetResultKey(result).c_str(),
+			match->second->median_ns, result.median_ns, result.median_ns / max(match->second->median_ns, 1e-9), low, high);
+		out << line << endl;
+	}
+	out << compared << " configuration(s) compared, " << regressions << " regression(s), " << improvements << " improvement(s) beyond "
+		<< options.threshold * 100 << "%";
+	if (missing > 0)
+		out << ", " << missing << " missing from this run";
+	if (added > 0)
+		out << ", " << added << " not in the baseline";
+	out << endl;
+	return regressions + missing;
+}
@@ -0,0 +1,402 @@
+#include "HistogramEqualizer.h"
+#include "Pipeline.h"
+#include <cstdint>
+
+template <typename T>
+HistogramEqualizer<T>::HistogramEqualizer(int platform_id, int device_id, const EqualizerFormat& format, const EqualizerOptions& options)
+	: format_(format), options_(options), context_(GetContext(platform_id, device_id)) {
+	Init();
+}
+
+template <typename T>
+HistogramEqualizer<T>::HistogramEqualizer(const cl::Context& context, const EqualizerFormat& format, const EqualizerOptions& options)
+	: format_(format), options_(options), context_(context) {
+	Init();
+}
+
+//Settings of a kernel the tuning file has nothing for, the same defaults GetWorkerConfig gives untuned devices
+static LaunchConfig GetDefaultConfig(const cl::Kernel& kernel, const cl::Device& device, const string& kernel_name) {
+	LaunchConfig config;
+	config.work_group_size = min(kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device), (size_t)256);
+	if (kernel_name == "histogram_private")
+		config.pixels_per_item = 64;
+	return config;
+}
+
+template <typename T>
+void HistogramEqualizer<T>::Init() {
+	if (format_.width == 0 || format_.height == 0 || format_.channels < 1)
+		throw cl::Error(CL_INVALID_VALUE, "HistogramEqualizer: empty image format");
+	if (format_.bit_depth < 1 || format_.bit_depth > (int)(8 * sizeof(T)))
+		throw cl::Error(CL_INVALID_VALUE, "HistogramEqualizer: bit depth does not fit the pixel type");
+	channel_size_ = format_.width * format_.height;
+	levels_ = (size_t)1 << format_.bit_depth;
+	if (format_.nr_bins < 1 || (size_t)format_.nr_bins > levels_)
+		throw cl::Error(CL_INVALID_VALUE, "HistogramEqualizer: number of bins has to be between 1 and 2^bit_depth");
+	GetBinMapping(format_.nr_bins, format_.bit_depth, bin_mul_, bin_shift_);
+
+	device_ = context_.getInfo<CL_CONTEXT_DEVICES>()[0];
+	queue_ = cl::CommandQueue(context_, device_, CL_QUEUE_PROFILING_ENABLE);
+	caps_ = ProbeDevice(device_);
+	mem_base_align_ = device_.getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>() / 8;
+
+	//the kernels are chosen after the build, which can turn sub-groups off
+	cl::Program::Sources sources;
+	AddKernelSources(sources);
+	program_ = BuildKernelProgram(context_, device_, caps_, format_.bit_depth, sources);
+	plan_ = ChooseKernels(caps_, format_.nr_bins, format_.bit_depth, format_.width, format_.height, format_.channels);
+	histogram_kernel_ = cl::Kernel(program_, plan_.histogram.c_str());
+	scan_kernel_ = cl::Kernel(program_, plan_.scan.c_str());
+	lut_reciprocal_kernel_ = cl::Kernel(program_, "lut_reciprocal");
+	lut_build_kernel_ = cl::Kernel(program_, "lut_build_reciprocal");
+	lut_kernel_ = cl::Kernel(program_, plan_.lut.c_str());
+	histogram_batched_kernel_ = cl::Kernel(program_, "histogram_batched");
+	lut_batched_kernel_ = cl::Kernel(program_, "lut_apply_batched");
+
+	const size_t image_bytes = channel_size_ * format_.channels * sizeof(T);
+	const size_t histogram_bytes = sizeof(cl_uint) * format_.nr_bins * format_.channels;
+	//with zero copy the image buffers wrap the caller's memory and are created per call instead, own buffers are then only
+	//made for memory that cannot be wrapped
+	if (!plan_.zero_copy) {
+		own_image_ = cl::Buffer(context_, CL_MEM_READ_ONLY, image_bytes);
+		own_output_ = cl::Buffer(context_, CL_MEM_WRITE_ONLY, image_bytes);
+	}
+	histogram_ = cl::Buffer(context_, CL_MEM_READ_WRITE, histogram_bytes);
+	cumulative_histogram_ = cl::Buffer(context_, CL_MEM_READ_WRITE, histogram_bytes);
+	reciprocals_ = cl::Buffer(context_, CL_MEM_READ_WRITE, sizeof(cl_ulong) * 4 * format_.channels);
+	lut_ = cl::Buffer(context_, CL_MEM_READ_WRITE, sizeof(T) * levels_ * format_.channels);
+	if (plan_.lut == "lut_apply_image") {
+		const cl::ImageFormat image_format = GetLutImageFormat(format_.bit_depth);
+		input_image_ = cl::Image2D(context_, CL_MEM_READ_ONLY, image_format, format_.width, format_.height * format_.channels);
+		output_image_ = cl::Image2D(context_, CL_MEM_WRITE_ONLY, image_format, format_.width, format_.height * format_.channels);
+		lut_image_ = cl::Image1DBuffer(context_, CL_MEM_READ_ONLY, image_format, levels_ * format_.channels, lut_);
+	}
+
+	tuning_.file_name = options_.tuning_file;
+	if (!tuning_.file_name.empty())
+		LoadTuning(tuning_);
+	const int bit_depth = format_.bit_depth;
+	const int nr_bins = format_.nr_bins;
+	histogram_config_ = FindLaunchConfig(tuning_, GetTuningKey(plan_.histogram, bit_depth, nr_bins), GetDefaultConfig(histogram_kernel_, device_, plan_.histogram));
+	scan_config_.work_group_size = nr_bins; //scan_local, one work item per bin
+	if (plan_.scan == "scan_blocked")
+		scan_config_ = FindLaunchConfig(tuning_, GetTuningKey(plan_.scan, bit_depth, nr_bins), GetDefaultConfig(scan_kernel_, device_, plan_.scan));
+	lut_config_ = FindLaunchConfig(tuning_, GetTuningKey(plan_.lut, bit_depth, nr_bins), GetDefaultConfig(lut_kernel_, device_, plan_.lut));
+
+	//small images are the point of the batched kernels, so a modest work group and 16 pixels per work item unless the tuning file says otherwise
+	LaunchConfig batch_config;
+	batch_config.work_group_size = min({ (size_t)256, histogram_batched_kernel_.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device_),
+		lut_batched_kernel_.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device_) });
+	batch_config.pixels_per_item = 16;
+	batch_config_ = FindLaunchConfig(tuning_, GetTuningKey("histogram_batched", format_.bit_depth, format_.nr_bins), batch_config);
+}
+
+//Benchmarks what the tuning file does not have (everything with retune) on image and saves the result if asked to.
+//Same search as the single device path of Tutorial 2, the histogram is tuned on the first channel (at most 16M pixels).
+template <typename T>
+void HistogramEqualizer<T>::tune(Span<const T> image, bool retune) {
+	EnqueueUpload(image);
+	if (own_output_() == NULL) //the LUT kernel needs somewhere to write while it is tuned
+		own_output_ = cl::Buffer(context_, CL_MEM_WRITE_ONLY, image.size * sizeof(T));
+	output_ = own_output_;
+	tuning_.force = retune;
+	const int bit_depth = format_.bit_depth;
+	const int nr_bins = format_.nr_bins;
+	const size_t max_work_group_size = caps_.max_work_group_size;
+
+	string histogram_key = GetTuningKey(plan_.histogram, bit_depth, nr_bins);
+	if (tuning_.force || tuning_.configs.count(histogram_key) == 0) {
+		TuningSpace space;
+		space.work_group_sizes = GetWorkGroupCandidates(min(max_work_group_size, histogram_kernel_.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device_)));
+		space.pixels_per_item = { 1, 4, 16, 64, 256 };
+		space.replicas = { 1 };
+		if (plan_.histogram == "histogram_local") {
+			for (cl_uint replicas = 2; replicas <= 8 && sizeof(cl_uint) * nr_bins * replicas <= caps_.local_mem_size; replicas *= 2)
+				space.replicas.push_back(replicas);
+		}
+		size_t tuning_size = min(channel_size_, (size_t)1 << 24);
+		tuning_.configs[histogram_key] = Autotune(space, [&](const LaunchConfig& config) {
+			queue_.enqueueFillBuffer(histogram_, (cl_uint)0, 0, sizeof(cl_uint) * nr_bins);
+			return EnqueueHistogram(queue_, histogram_kernel_, plan_.histogram, image_, histogram_, tuning_size, 1, nr_bins, bin_mul_, bin_shift_, config);
+		});
+		tuning_.changed = true;
+	}
+	histogram_config_ = tuning_.configs[histogram_key];
+
+	scan_config_.work_group_size = nr_bins; //scan_local, one work item per bin
+	if (plan_.scan == "scan_blocked") {
+		string scan_key = GetTuningKey(plan_.scan, bit_depth, nr_bins);
+		if (tuning_.force || tuning_.configs.count(scan_key) == 0) {
+			TuningSpace space;
+			space.work_group_sizes = GetWorkGroupCandidates(min(max_work_group_size, scan_kernel_.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device_)));
+			space.pixels_per_item = { 1 };
+			space.replicas = { 1 };
+			tuning_.configs[scan_key] = Autotune(space, [&](const LaunchConfig& config) {
+				return EnqueueScan(queue_, scan_kernel_, histogram_, cumulative_histogram_, format_.channels, nr_bins, config);
+			});
+			tuning_.changed = true;
+		}
+		scan_config_ = tuning_.configs[scan_key];
+	}
+
+	string lut_key = GetTuningKey(plan_.lut, bit_depth, nr_bins);
+	if (tuning_.force || tuning_.configs.count(lut_key) == 0) {
+		TuningSpace space;
+		space.work_group_sizes = GetWorkGroupCandidates(min(max_work_group_size, lut_kernel_.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device_)));
+		space.pixels_per_item = { 1 };
+		space.replicas = { 1 };
+		tuning_.configs[lut_key] = Autotune(space, [&](const LaunchConfig& config) {
+			return EnqueueLutApply(config);
+		});
+		tuning_.changed = true;
+	}
+	lut_config_ = tuning_.configs[lut_key];
+
+	if (tuning_.changed && options_.save_tuning && !tuning_.file_name.empty())
+		SaveTuning(tuning_);
+	tuning_.force = false;
+	queue_.finish();
+}
+
+template <typename T>
+void HistogramEqualizer<T>::CheckSize(size_t size, size_t expected, const char* message) const {
+	if (size != expected)
+		throw cl::Error(CL_INVALID_VALUE, message);
+}
+
+//Caller memory is only wrapped on devices that share memory with the host and if it is aligned the way the device wants it
+//(CL_DEVICE_MEM_BASE_ADDR_ALIGN), like CanWrapFrame does for the frame ring
+template <typename T>
+bool HistogramEqualizer<T>::CanWrap(const void* data) const {
+	return plan_.zero_copy && (mem_base_align_ == 0 || (uintptr_t)data % mem_base_align_ == 0);
+}
+
+//Wrapped where possible (CL_MEM_USE_HOST_PTR, it is only ever read so the const_cast is fine), copied into own_image_ otherwise
+template <typename T>
+void HistogramEqualizer<T>::EnqueueUpload(Span<const T> image) {
+	CheckSize(image.size, channel_size_ * format_.channels, "HistogramEqualizer: image size does not match the format");
+	events_ = EqualizerEvents();
+	if (CanWrap(image.data)) {
+		image_ = cl::Buffer(context_, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, image.size * sizeof(T), const_cast<T*>(image.data));
+		return;
+	}
+	if (own_image_() == NULL)
+		own_image_ = cl::Buffer(context_, CL_MEM_READ_ONLY, image.size * sizeof(T));
+	image_ = own_image_;
+	queue_.enqueueWriteBuffer(image_, CL_FALSE, 0, image.size * sizeof(T), image.data, NULL, &events_.upload);
+}
+
+//The histogram is accumulated with atomics so it starts from zero, the in-order queue keeps the commands in sequence
+template <typename T>
+void HistogramEqualizer<T>::EnqueueHistogramAndScan(bool scan) {
+	queue_.enqueueFillBuffer(histogram_, (cl_uint)0, 0, sizeof(cl_uint) * format_.nr_bins * format_.channels, NULL, &events_.histogram_fill);
+	events_.histogram = EnqueueHistogram(queue_, histogram_kernel_, plan_.histogram, image_, histogram_,
+		channel_size_, format_.channels, format_.nr_bins, bin_mul_, bin_shift_, histogram_config_);
+	if (scan)
+		events_.scan = EnqueueScan(queue_, scan_kernel_, histogram_, cumulative_histogram_, format_.channels, format_.nr_bins, scan_config_);
+}
+
+//The LUT kernel of the plan from image_ to output_. lut_apply_image reads a copy of image_ in input_image_ (made on the device,
+//the histogram kernels still need the buffer) and writes output_image_ instead.
+template <typename T>
+cl::Event HistogramEqualizer<T>::EnqueueLutApply(const LaunchConfig& config) {
+	if (plan_.lut != "lut_apply_image")
+		return EnqueueLut(queue_, lut_kernel_, plan_.lut, image_, output_, lut_, channel_size_, format_.channels, levels_, config);
+	queue_.enqueueCopyBufferToImage(image_, input_image_, 0, { 0, 0, 0 }, { format_.width, format_.height * format_.channels, 1 }, NULL, &events_.image_copy);
+	return EnqueueLutImage(queue_, lut_kernel_, input_image_, output_image_, lut_image_, format_.width, format_.height, format_.channels, levels_, config);
+}
+
+template <typename T>
+cl::Event HistogramEqualizer<T>::histogram_async(Span<const T> image, Span<cl_uint> histogram) {
+	CheckSize(histogram.size, (size_t)format_.nr_bins * format_.channels, "HistogramEqualizer: histogram needs nr_bins * channels values");
+	EnqueueUpload(image);
+	EnqueueHistogramAndScan(false);
+	queue_.enqueueReadBuffer(histogram_, CL_FALSE, 0, histogram.size * sizeof(cl_uint), histogram.data, NULL, &events_.download);
+	queue_.flush();
+	return events_.download;
+}
+
+template <typename T>
+cl::Event HistogramEqualizer<T>::cdf_async(Span<const T> image, Span<cl_uint> cdf) {
+	CheckSize(cdf.size, (size_t)format_.nr_bins * format_.channels, "HistogramEqualizer: cdf needs nr_bins * channels values");
+	EnqueueUpload(image);
+	EnqueueHistogramAndScan(true);
+	queue_.enqueueReadBuffer(cumulative_histogram_, CL_FALSE, 0, cdf.size * sizeof(cl_uint), cdf.data, NULL, &events_.download);
+	queue_.flush();
+	return events_.download;
+}
+
+template <typename T>
+cl::Event HistogramEqualizer<T>::equalize_async(Span<const T> input, Span<T> output) {
+	return equalize_async(input, output, Span<cl_uint>());
+}
+
+//Everything stays on the device (the LUT is built by lut_reciprocal and lut_build_reciprocal), so nothing in here waits for the device.
+//The cumulative histogram is only read back if cdf is not empty, the in-order queue has it done before the output.
+template <typename T>
+cl::Event HistogramEqualizer<T>::equalize_async(Span<const T> input, Span<T> output, Span<cl_uint> cdf) {
+	CheckSize(output.size, channel_size_ * format_.channels, "HistogramEqualizer: output size does not match the format");
+	if (cdf.size > 0)
+		CheckSize(cdf.size, (size_t)format_.nr_bins * format_.channels, "HistogramEqualizer: cdf needs nr_bins * channels values");
+	EnqueueUpload(input);
+	EnqueueHistogramAndScan(true);
+	if (cdf.size > 0)
+		queue_.enqueueReadBuffer(cumulative_histogram_, CL_FALSE, 0, cdf.size * sizeof(cl_uint), cdf.data, NULL, &events_.cdf_download);
+	const bool image_lut = plan_.lut == "lut_apply_image";
+	const bool wrap_output = !image_lut && CanWrap(output.data);
+	if (wrap_output) {
+		output_ = cl::Buffer(context_, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, output.size * sizeof(T), output.data);
+	}
+	else if (!image_lut) {
+		if (own_output_() == NULL)
+			own_output_ = cl::Buffer(context_, CL_MEM_WRITE_ONLY, output.size * sizeof(T));
+		output_ = own_output_;
+	}
+	events_.lut_build = EnqueueLutBuildReciprocal(queue_, lut_reciprocal_kernel_, lut_build_kernel_, cumulative_histogram_, reciprocals_, lut_,
+		format_.channels, format_.nr_bins, levels_, bin_mul_, bin_shift_, NULL, &events_.lut_reciprocal);
+	events_.lut = EnqueueLutApply(lut_config_);
+	if (image_lut) {
+		queue_.enqueueReadImage(output_image_, CL_FALSE, { 0, 0, 0 }, { format_.width, format_.height * format_.channels, 1 }, 0, 0, output.data, NULL, &events_.download);
+	}
+	else if (wrap_output) {
+		//the result is already in the output span, mapping it just makes sure the host sees it
+		void* mapped = queue_.enqueueMapBuffer(output_, CL_FALSE, CL_MAP_READ, 0, output.size * sizeof(T), NULL, &events_.output_map);
+		queue_.enqueueUnmapMemObject(output_, mapped, NULL, &events_.download);
+	}
+	else {
+		queue_.enqueueReadBuffer(output_, CL_FALSE, 0, output.size * sizeof(T), output.data, NULL, &events_.download);
+	}
+	queue_.flush();
+	return events_.download;
+}
+
+template <typename T>
+cl::Event HistogramEqualizer<T>::equalize_async(Span<const T> input, Span<T> output, const CompletionCallback& callback) {
+	cl::Event event = equalize_async(input, output);
+	SetCompletionCallback(event, callback);
+	return event;
+}
+
+//Settles the promise from the completion callback, result is only read once the commands writing to it are done
+template <typename R>
+static void SetPromise(std::shared_ptr<std::promise<R>> promise, std::shared_ptr<R> result, cl_int status) {
+	if (status == CL_COMPLETE)
+		promise->set_value(std::move(*result));
+	else
+		promise->set_exception(std::make_exception_ptr(cl::Error(status, "HistogramEqualizer: queued command failed")));
+}
+
+template <typename T>
+std::future<vector<cl_uint>> HistogramEqualizer<T>::histogram_future(Span<const T> image) {
+	auto promise = std::make_shared<std::promise<vector<cl_uint>>>();
+	auto result = std::make_shared<vector<cl_uint>>((size_t)format_.nr_bins * format_.channels);
+	cl::Event event = histogram_async(image, *result);
+	SetCompletionCallback(event, [promise, result](cl_int status) { SetPromise(promise, result, status); });
+	return promise->get_future();
+}
+
+template <typename T>
+std::future<vector<cl_uint>> HistogramEqualizer<T>::cdf_future(Span<const T> image) {
+	auto promise = std::make_shared<std::promise<vector<cl_uint>>>();
+	auto result = std::make_shared<vector<cl_uint>>((size_t)format_.nr_bins * format_.channels);
+	cl::Event event = cdf_async(image, *result);
+	SetCompletionCallback(event, [promise, result](cl_int status) { SetPromise(promise, result, status); });
+	return promise->get_future();
+}
+
+template <typename T>
+std::future<void> HistogramEqualizer<T>::equalize_future(Span<const T> input, Span<T> output) {
+	auto promise = std::make_shared<std::promise<void>>();
+	std::future<void> future = promise->get_future();
+	equalize_async(input, output, [promise](cl_int status) {
+		if (status == CL_COMPLETE)
+			promise->set_value();
+		else
+			promise->set_exception(std::make_exception_ptr(cl::Error(status, "HistogramEqualizer: queued command failed")));
+	});
+	return future;
+}
+
+//Grows buffer to at least bytes, the contents are not kept
+static void ReserveBuffer(const cl::Context& context, cl::Buffer& buffer, size_t& capacity, size_t bytes, cl_mem_flags flags) {
+	if (bytes > capacity) {
+		buffer = cl::Buffer(context, flags, bytes);
+		capacity = bytes;
+	}
+}
+
+template <typename T>
+cl::Event HistogramEqualizer<T>::equalize_batch_async(Span<const T> images, Span<const cl_uint> offsets, Span<T> output) {
+	const int channels = format_.channels;
+	const int nr_bins = format_.nr_bins;
+	if (offsets.size < 2 || offsets.data[0] != 0 || offsets.data[offsets.size - 1] != images.size)
+		throw cl::Error(CL_INVALID_VALUE, "HistogramEqualizer: batch offsets have to go from 0 to the size of the packed images");
+	CheckSize(output.size, images.size, "HistogramEqualizer: batch output size does not match the images");
+	if (sizeof(cl_uint) * nr_bins > caps_.local_mem_size)
+		throw cl::Error(CL_INVALID_VALUE, "HistogramEqualizer: too many bins for the batched kernels");
+	size_t max_channel_size = 0;
+	for (size_t i = 0; i + 1 < offsets.size; i++) {
+		if (offsets.data[i + 1] < offsets.data[i] || (offsets.data[i + 1] - offsets.data[i]) % channels != 0)
+			throw cl::Error(CL_INVALID_VALUE, "HistogramEqualizer: every batch image needs a whole number of pixels in each channel");
+		max_channel_size = max(max_channel_size, (size_t)(offsets.data[i + 1] - offsets.data[i]) / channels);
+	}
+	const size_t slices = (offsets.size - 1) * channels;
+
+	const size_t image_bytes = images.size * sizeof(T);
+	const size_t histogram_bytes = sizeof(cl_uint) * nr_bins * slices;
+	ReserveBuffer(context_, batch_images_, batch_image_bytes_, image_bytes, CL_MEM_READ_ONLY);
+	ReserveBuffer(context_, batch_output_, batch_output_bytes_, image_bytes, CL_MEM_WRITE_ONLY);
+	ReserveBuffer(context_, batch_offsets_, batch_offsets_bytes_, offsets.size * sizeof(cl_uint), CL_MEM_READ_ONLY);
+	ReserveBuffer(context_, batch_histogram_, batch_histogram_bytes_, histogram_bytes, CL_MEM_READ_WRITE);
+	ReserveBuffer(context_, batch_cumulative_histogram_, batch_cumulative_histogram_bytes_, histogram_bytes, CL_MEM_READ_WRITE);
+	ReserveBuffer(context_, batch_reciprocals_, batch_reciprocals_bytes_, sizeof(cl_ulong) * 4 * slices, CL_MEM_READ_WRITE);
+	ReserveBuffer(context_, batch_lut_, batch_lut_bytes_, sizeof(T) * levels_ * slices, CL_MEM_READ_WRITE);
+
+	//one launch per step for the whole batch, the in-order queue keeps them in sequence
+	events_ = EqualizerEvents();
+	queue_.enqueueWriteBuffer(batch_offsets_, CL_FALSE, 0, offsets.size * sizeof(cl_uint), offsets.data, NULL, &events_.offsets_upload);
+	queue_.enqueueWriteBuffer(batch_images_, CL_FALSE, 0, image_bytes, images.data, NULL, &events_.upload);
+	queue_.enqueueFillBuffer(batch_histogram_, (cl_uint)0, 0, histogram_bytes, NULL, &events_.histogram_fill);
+	events_.histogram = EnqueueHistogramBatched(queue_, histogram_batched_kernel_, batch_images_, batch_offsets_, batch_histogram_,
+		slices, channels, nr_bins, bin_mul_, bin_shift_, max_channel_size, batch_config_);
+	events_.scan = EnqueueScan(queue_, scan_kernel_, batch_histogram_, batch_cumulative_histogram_, (int)slices, nr_bins, scan_config_);
+	events_.lut_build = EnqueueLutBuildReciprocal(queue_, lut_reciprocal_kernel_, lut_build_kernel_, batch_cumulative_histogram_, batch_reciprocals_, batch_lut_,
+		(int)slices, nr_bins, levels_, bin_mul_, bin_shift_, NULL, &events_.lut_reciprocal);
+	events_.lut = EnqueueLutBatched(queue_, lut_batched_kernel_, batch_images_, batch_output_, batch_offsets_, batch_lut_,
+		slices, channels, levels_, max_channel_size, batch_config_);
+	queue_.enqueueReadBuffer(batch_output_, CL_FALSE, 0, image_bytes, output.data, NULL, &events_.download);
+	queue_.flush();
+	return events_.download;
+}
+
+template <typename T>
+void HistogramEqualizer<T>::equalize_batch(Span<const T> images, Span<const cl_uint> offsets, Span<T> output) {
+	equalize_batch_async(images, offsets, output).wait();
+}
+
+template <typename T>
+vector<cl_uint> HistogramEqualizer<T>::histogram(Span<const T> image) {
+	vector<cl_uint> result((size_t)format_.nr_bins * format_.channels);
+	histogram_async(image, result).wait();
+	return result;
+}
+
+template <typename T>
+vector<cl_uint> HistogramEqualizer<T>::cdf(Span<const T> image) {
+	vector<cl_uint> result((size_t)format_.nr_bins * format_.channels);
+	cdf_async(image, result).wait();
+	return result;
+}
+
+template <typename T>
+void HistogramEqualizer<T>::equalize(Span<const T> input, Span<T> output) {
+	equalize_async(input, output).wait();
+}
+
+template <typename T>
+void HistogramEqualizer<T>::equalize(Span<const T> input, Span<T> output, Span<cl_uint> cdf) {
+	equalize_async(input, output, cdf).wait();
+}
+
+template class HistogramEqualizer<unsigned char>;
+template class HistogramEqualizer<unsigned short>;
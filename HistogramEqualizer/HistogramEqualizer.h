@@ -0,0 +1,185 @@
+#pragma once
+
+//Library interface of the histogram equalisation, for programs that want to embed it instead of running Tutorial 2.
+//A HistogramEqualizer owns the context, queue, program, kernels and buffers for one device and one image format,
+//so after the constructor every call only moves the image and launches kernels.
+//
+//	HistogramEqualizer<unsigned char> equalizer(0, 0, { width, height, 1, 8, 256 });
+//	equalizer.equalize({ input.data(), input.size() }, { output.data(), output.size() });
+//
+//Launch settings are defaults unless EqualizerOptions names a tuning file or tune() is called on a representative image first.
+//
+//Many frames can be kept in flight from one thread with the future or callback variants, e.g.
+//	futures.push_back(equalizer.equalize_future(frame, output));	//returns straight away
+//	equalizer.equalize_async(frame, output, [](cl_int status) { ... });	//called from an OpenCL thread when done
+
+#include <functional>
+#include <future>
+#include <memory>
+#include "Utils.h"
+#include "Tuning.h"
+#include "Dispatch.h"
+
+//Pointer and number of elements, a stand in for std::span (the project builds as C++14). The caller owns the memory.
+template <typename T>
+struct Span {
+	T* data = nullptr;
+	size_t size = 0;
+
+	Span() {}
+	Span(T* data, size_t size) : data(data), size(size) {}
+	template <typename U>
+	Span(vector<U>& v) : data(v.data()), size(v.size()) {}
+	template <typename U>
+	Span(const vector<U>& v) : data(v.data()), size(v.size()) {}
+};
+
+//Images an equalizer works on. Fixed for its lifetime, the program, kernel plan and buffers depend on it.
+//Pixels are stored one channel after another (like CImg), bit_depth can be anything up to the pixel type (e.g. 12 in unsigned short).
+struct EqualizerFormat {
+	size_t width = 0;
+	size_t height = 0;
+	int channels = 1;
+	int bit_depth = 8;
+	int nr_bins = 256;
+};
+
+//Where the launch settings come from. By default nothing is benchmarked and no file is read or written: every kernel runs with
+//defaults (the ones the multi-device mode uses for untuned devices) until tune() is called or a tuning file is given.
+struct EqualizerOptions {
+	string tuning_file; //settings read in the constructor, e.g. GetTuningFileName(device) like Tutorial 2 does
+	bool save_tuning = false; //tune() writes everything it knows back to tuning_file
+};
+
+//Events of the last call, one for every command it enqueued, for profiling (commands a call did not need are left empty)
+struct EqualizerEvents {
+	cl::Event offsets_upload; //equalize_batch only
+	cl::Event upload;
+	cl::Event histogram_fill; //zeroes the histogram before the histogram kernel
+	cl::Event histogram;
+	cl::Event scan;
+	cl::Event cdf_download; //only when equalize was given a span for the cumulative histogram
+	cl::Event lut_reciprocal;
+	cl::Event lut_build; //lut_build_reciprocal
+	cl::Event image_copy; //lut_apply_image only, the input buffer copied into the input image
+	cl::Event lut;
+	cl::Event output_map; //wrapped output only, the map before the unmap that is the download
+	cl::Event download;
+};
+
+//Called by the runtime with the execution status of the event, CL_COMPLETE or a negative error code
+typedef std::function<void(cl_int status)> CompletionCallback;
+
+inline void CL_CALLBACK EventCompleted(cl_event, cl_int status, void* user_data) {
+	std::unique_ptr<CompletionCallback> callback(static_cast<CompletionCallback*>(user_data));
+	(*callback)(status);
+}
+
+//Runs callback once the event has finished, on a thread of the OpenCL runtime. It should be short and must not
+//wait for other OpenCL commands (that can stall the runtime), handing the result over to another thread is fine.
+inline void SetCompletionCallback(cl::Event& event, const CompletionCallback& callback) {
+	CompletionCallback* user_data = new CompletionCallback(callback);
+	try {
+		event.setCallback(CL_COMPLETE, EventCompleted, user_data);
+	}
+	catch (...) {
+		delete user_data;
+		throw;
+	}
+}
+
+//T is unsigned char for images up to 8 bits and unsigned short for anything deeper (both are compiled into the library)
+template <typename T>
+class HistogramEqualizer {
+public:
+	//Picks the device like the -p and -d options do
+	HistogramEqualizer(int platform_id, int device_id, const EqualizerFormat& format, const EqualizerOptions& options = EqualizerOptions());
+	//Runs on the first device of an existing context
+	HistogramEqualizer(const cl::Context& context, const EqualizerFormat& format, const EqualizerOptions& options = EqualizerOptions());
+
+	//Benchmarks the launch settings on a typical image and blocks until that is done, for every kernel the tuning file has
+	//no entry for (all of them with retune), then saves them if options.save_tuning is set. Optional, the other calls never tune.
+	void tune(Span<const T> image, bool retune = false);
+
+	//Histogram of every channel, nr_bins values per channel
+	vector<cl_uint> histogram(Span<const T> image);
+	//Cumulative histogram of every channel, not normalised
+	vector<cl_uint> cdf(Span<const T> image);
+	void equalize(Span<const T> input, Span<T> output);
+	//Also copies the cumulative histogram of this image into cdf (nr_bins * channels values), without running the pipeline twice
+	void equalize(Span<const T> input, Span<T> output, Span<cl_uint> cdf);
+
+	//Same as above but only queued, the returned event completes once the result is in the output span.
+	//The spans have to stay valid until then. Calls run one after another on the queue of the equalizer.
+	cl::Event histogram_async(Span<const T> image, Span<cl_uint> histogram);
+	cl::Event cdf_async(Span<const T> image, Span<cl_uint> cdf);
+	cl::Event equalize_async(Span<const T> input, Span<T> output);
+	cl::Event equalize_async(Span<const T> input, Span<T> output, Span<cl_uint> cdf);
+	//Queued as well, callback gets the status once the output span holds the result (or the commands failed)
+	cl::Event equalize_async(Span<const T> input, Span<T> output, const CompletionCallback& callback);
+
+	//Futures for the same calls, they hold the result or throw cl::Error from get() if a command failed.
+	//Only the output span of equalize_future has to stay valid, histograms are returned by value.
+	std::future<vector<cl_uint>> histogram_future(Span<const T> image);
+	std::future<vector<cl_uint>> cdf_future(Span<const T> image);
+	std::future<void> equalize_future(Span<const T> input, Span<T> output);
+
+	//Many small images (thumbnails, crops) with one launch per step instead of one per image. The images are packed
+	//one after another, each with format().channels channels stored one after another, and offsets has images + 1 entries:
+	//image i is images[offsets[i]] up to images[offsets[i + 1]] and equalised into the same range of output.
+	//Width and height of the format are not used, only channels, bit depth and bins. nr_bins has to fit into local memory.
+	cl::Event equalize_batch_async(Span<const T> images, Span<const cl_uint> offsets, Span<T> output);
+	void equalize_batch(Span<const T> images, Span<const cl_uint> offsets, Span<T> output);
+
+	//Blocks until every queued call has finished, e.g. before the spans of the last frames go away
+	void finish() { queue_.finish(); }
+
+	const EqualizerFormat& format() const { return format_; }
+	const DeviceCaps& caps() const { return caps_; }
+	const KernelPlan& plan() const { return plan_; }
+	const TuningTable& tuning() const { return tuning_; }
+	const EqualizerEvents& events() const { return events_; }
+	const LaunchConfig& histogram_config() const { return histogram_config_; }
+	const cl::Context& context() const { return context_; }
+	cl::CommandQueue& queue() { return queue_; }
+
+private:
+	void Init();
+	void CheckSize(size_t size, size_t expected, const char* message) const;
+	bool CanWrap(const void* data) const;
+	void EnqueueUpload(Span<const T> image);
+	void EnqueueHistogramAndScan(bool scan);
+	cl::Event EnqueueLutApply(const LaunchConfig& config);
+
+	EqualizerFormat format_;
+	EqualizerOptions options_;
+	size_t channel_size_ = 0;
+	size_t levels_ = 0;
+	cl_uint bin_mul_ = 1;
+	cl_uint bin_shift_ = 0;
+
+	cl::Context context_;
+	cl::Device device_;
+	cl::CommandQueue queue_;
+	cl::Program program_;
+	DeviceCaps caps_;
+	KernelPlan plan_;
+	TuningTable tuning_;
+	size_t mem_base_align_ = 0; //CL_DEVICE_MEM_BASE_ADDR_ALIGN in bytes, what caller memory needs to be wrapped
+
+	cl::Kernel histogram_kernel_, scan_kernel_, lut_reciprocal_kernel_, lut_build_kernel_, lut_kernel_;
+	LaunchConfig histogram_config_, scan_config_, lut_config_;
+	//image_ and output_ are either own_image_ and own_output_ or, with zero copy, the caller's memory wrapped for one call
+	cl::Buffer image_, output_, own_image_, own_output_, histogram_, cumulative_histogram_, reciprocals_, lut_;
+	//lut_apply_image only: the channels stacked into one image each for input and output, and lut_ seen as a 1D image
+	cl::Image2D input_image_, output_image_;
+	cl::Image1DBuffer lut_image_;
+
+	//batched kernels, the buffers grow to the largest batch seen so far
+	cl::Kernel histogram_batched_kernel_, lut_batched_kernel_;
+	LaunchConfig batch_config_;
+	cl::Buffer batch_images_, batch_output_, batch_offsets_, batch_histogram_, batch_cumulative_histogram_, batch_reciprocals_, batch_lut_;
+	size_t batch_image_bytes_ = 0, batch_output_bytes_ = 0, batch_offsets_bytes_ = 0;
+	size_t batch_histogram_bytes_ = 0, batch_cumulative_histogram_bytes_ = 0, batch_reciprocals_bytes_ = 0, batch_lut_bytes_ = 0;
+	EqualizerEvents events_;
+};
@@ -0,0 +1,296 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <exception>
+#include <chrono>
+#include "Utils.h"
+#include "CImg.h"
+#include "Tuning.h"
+#include "Pipeline.h"
+#include "MultiDevice.h"
+#include "ImageIO.h"
+#include "Trace.h"
+#include "HistogramEqualizer.h"
+
+using namespace cimg_library;
+
+//One pipeline instance: the kernels, launch settings and buffers a worker reuses for the images of a batch.
+//The buffers only grow, so a batch of same sized images allocates them once. Every image in flight needs its own instance.
+struct WorkerPipeline {
+	cl::Kernel histogram_kernel, scan_kernel, lut_reciprocal_kernel, lut_build_kernel, lut_kernel;
+	LaunchConfig histogram_config, scan_config, lut_config;
+	cl::Buffer image, output, histogram, cumulative_histogram, reciprocals, lut;
+	size_t image_bytes = 0;
+	size_t histogram_bytes = 0;
+	size_t reciprocals_bytes = 0;
+	size_t lut_bytes = 0;
+	//last command that used each buffer, the next image in the pipeline waits for it before it overwrites the buffer
+	cl::Event image_used, histogram_used, cumulative_histogram_used, lut_used, output_used;
+};
+
+inline WorkerPipeline CreatePipeline(const DeviceWorker& worker, int nr_bins, int bit_depth) {
+	WorkerPipeline pipeline;
+	pipeline.histogram_kernel = cl::Kernel(worker.program, worker.plan.histogram.c_str());
+	pipeline.scan_kernel = cl::Kernel(worker.program, worker.plan.scan.c_str());
+	pipeline.lut_reciprocal_kernel = cl::Kernel(worker.program, "lut_reciprocal");
+	pipeline.lut_build_kernel = cl::Kernel(worker.program, "lut_build_reciprocal");
+	pipeline.lut_kernel = cl::Kernel(worker.program, worker.plan.lut.c_str());
+	pipeline.histogram_config = GetWorkerConfig(worker, pipeline.histogram_kernel, worker.plan.histogram, bit_depth, nr_bins);
+	pipeline.lut_config = GetWorkerConfig(worker, pipeline.lut_kernel, worker.plan.lut, bit_depth, nr_bins);
+	if (worker.plan.scan == "scan_local")
+		pipeline.scan_config.work_group_size = nr_bins; //one work item per bin
+	else
+		pipeline.scan_config = GetWorkerConfig(worker, pipeline.scan_kernel, worker.plan.scan, bit_depth, nr_bins);
+	return pipeline;
+}
+
+//The events that are set, for wait lists (an empty event is not a valid entry)
+inline vector<cl::Event> GetWaitList(std::initializer_list<cl::Event> events) {
+	vector<cl::Event> wait_list;
+	for (const cl::Event& event : events) {
+		if (event() != NULL)
+			wait_list.push_back(event);
+	}
+	return wait_list;
+}
+
+//Grows the buffers of a pipeline to the sizes of the next image (they are only ever reallocated to get bigger).
+//The buffers are CL_MEM_ALLOC_HOST_PTR so the runtime allocates them. Every new buffer is first written by a fill on the queue
+//of the worker, which for a sub-device from device fission runs on the cores of that sub-device, so a CPU runtime with first-touch
+//page placement puts the pages on their NUMA node (the uploads are host copies and would touch them from whatever thread enqueues).
+//The fill becomes the last use of the buffer, so the next commands on it wait for it also on out-of-order queues.
+inline void ReservePipelineBuffers(DeviceWorker& worker, WorkerPipeline& pipeline, size_t image_bytes, size_t histogram_bytes, size_t lut_bytes, size_t reciprocals_bytes = 0) {
+	auto first_touch = [&](const cl::Buffer& buffer, size_t bytes, cl::Event& used) {
+		worker.queue.enqueueFillBuffer(buffer, (cl_uchar)0, 0, bytes, NULL, &used);
+	};
+	if (image_bytes > pipeline.image_bytes) {
+		pipeline.image = cl::Buffer(worker.context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, image_bytes);
+		pipeline.output = cl::Buffer(worker.context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, image_bytes);
+		pipeline.image_bytes = image_bytes;
+		first_touch(pipeline.image, image_bytes, pipeline.image_used);
+		first_touch(pipeline.output, image_bytes, pipeline.output_used);
+	}
+	if (histogram_bytes > pipeline.histogram_bytes) {
+		pipeline.histogram = cl::Buffer(worker.context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, histogram_bytes);
+		pipeline.cumulative_histogram = cl::Buffer(worker.context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, histogram_bytes);
+		pipeline.histogram_bytes = histogram_bytes;
+		first_touch(pipeline.histogram, histogram_bytes, pipeline.histogram_used);
+		first_touch(pipeline.cumulative_histogram, histogram_bytes, pipeline.cumulative_histogram_used);
+	}
+	if (reciprocals_bytes > pipeline.reciprocals_bytes) {
+		//written by lut_reciprocal and only read by lut_build_reciprocal, both wait for lut_used
+		pipeline.reciprocals = cl::Buffer(worker.context, CL_MEM_READ_WRITE, reciprocals_bytes);
+		pipeline.reciprocals_bytes = reciprocals_bytes;
+	}
+	if (lut_bytes > pipeline.lut_bytes) {
+		pipeline.lut = cl::Buffer(worker.context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, lut_bytes);
+		pipeline.lut_bytes = lut_bytes;
+		first_touch(pipeline.lut, lut_bytes, pipeline.lut_used);
+	}
+}
+
+//One image of a batch on its way through a pipeline, the host side data has to stay alive until output_ready
+template <typename T>
+struct BatchImage {
+	size_t index = 0;
+	CImg<T> input, output;
+	cl::Event scan_done; //the cumulative histogram is in the pipeline
+	cl::Event output_ready;
+	chrono::steady_clock::time_point start;
+};
+
+//First half of the event chain of an image: upload and zeroing -> histogram -> scan.
+//Every command waits only for the events it really depends on and for the last use of the buffer it overwrites by the image
+//before in the same pipeline, so on an out-of-order queue the commands of the other images in flight can run in between
+//(on an in-order queue the wait lists change nothing).
+//With a trace every command is recorded on the track of the worker, named after the image it belongs to.
+template <typename T>
+void EnqueueHistogramStage(DeviceWorker& worker, WorkerPipeline& pipeline, BatchImage<T>& image, int nr_bins, int bit_depth, CommandTrace* trace = NULL, int track = 0) {
+	const int channels = image.input.spectrum();
+	const size_t channel_size = (size_t)image.input.width() * image.input.height() * image.input.depth();
+	const size_t image_bytes = image.input.size() * sizeof(T);
+	const size_t histogram_bytes = sizeof(cl_uint) * nr_bins * channels;
+	const size_t lut_bytes = sizeof(T) * ((size_t)1 << bit_depth) * channels;
+	cl_uint bin_mul, bin_shift;
+	GetBinMapping(nr_bins, bit_depth, bin_mul, bin_shift);
+
+	ReservePipelineBuffers(worker, pipeline, image_bytes, histogram_bytes, lut_bytes, sizeof(cl_ulong) * 4 * channels);
+
+	cl::CommandQueue& queue = worker.queue;
+	vector<cl::Event> write_waits = GetWaitList({ pipeline.image_used }), fill_waits = GetWaitList({ pipeline.histogram_used });
+	vector<cl::Event> histogram_waits(2);
+	queue.enqueueWriteBuffer(pipeline.image, CL_FALSE, 0, image_bytes, image.input.data(), &write_waits, &histogram_waits[0]);
+	queue.enqueueFillBuffer(pipeline.histogram, (cl_uint)0, 0, histogram_bytes, &fill_waits, &histogram_waits[1]);
+	cl::Event histogram_done = EnqueueHistogram(queue, pipeline.histogram_kernel, worker.plan.histogram, pipeline.image, pipeline.histogram,
+		channel_size, channels, nr_bins, bin_mul, bin_shift, pipeline.histogram_config, &histogram_waits);
+	vector<cl::Event> scan_waits = GetWaitList({ histogram_done, pipeline.cumulative_histogram_used });
+	image.scan_done = EnqueueScan(queue, pipeline.scan_kernel, pipeline.histogram, pipeline.cumulative_histogram, channels, nr_bins, pipeline.scan_config, &scan_waits);
+	pipeline.histogram_used = image.scan_done;
+
+	if (trace) {
+		const string suffix = " [" + to_string(image.index) + "]";
+		trace->Record(track, "write image" + suffix, histogram_waits[0]);
+		trace->Record(track, "fill histogram" + suffix, histogram_waits[1]);
+		trace->Record(track, worker.plan.histogram + suffix, histogram_done);
+		trace->Record(track, worker.plan.scan + suffix, image.scan_done);
+	}
+}
+
+//Second half: lut_reciprocal -> lut_build_reciprocal -> LUT kernel -> read back the output, chained on the device after the scan
+//like HistogramEqualizer does, so the host never waits in the middle of an image. The LUT build waits for the last LUT kernel of
+//the pipeline (the last reader of the LUT, and of the image), the LUT kernel for the last read of the output.
+template <typename T>
+void EnqueueLutStage(DeviceWorker& worker, WorkerPipeline& pipeline, BatchImage<T>& image, int nr_bins, int bit_depth, CommandTrace* trace = NULL, int track = 0) {
+	const int channels = image.input.spectrum();
+	const size_t channel_size = (size_t)image.input.width() * image.input.height() * image.input.depth();
+	const size_t levels = (size_t)1 << bit_depth;
+	const size_t image_bytes = image.input.size() * sizeof(T);
+	cl_uint bin_mul, bin_shift;
+	GetBinMapping(nr_bins, bit_depth, bin_mul, bin_shift);
+	image.output = CImg<T>(image.input.width(), image.input.height(), image.input.depth(), channels);
+
+	cl::CommandQueue& queue = worker.queue;
+	vector<cl::Event> build_waits = GetWaitList({ image.scan_done, pipeline.lut_used });
+	cl::Event reciprocal_done;
+	cl::Event lut_built = EnqueueLutBuildReciprocal(queue, pipeline.lut_reciprocal_kernel, pipeline.lut_build_kernel, pipeline.cumulative_histogram,
+		pipeline.reciprocals, pipeline.lut, channels, nr_bins, levels, bin_mul, bin_shift, &build_waits, &reciprocal_done);
+	vector<cl::Event> lut_waits = GetWaitList({ lut_built, pipeline.output_used });
+	cl::Event lut_done = EnqueueLut(queue, pipeline.lut_kernel, worker.plan.lut, pipeline.image, pipeline.output, pipeline.lut,
+		channel_size, channels, levels, pipeline.lut_config, &lut_waits);
+	vector<cl::Event> read_waits = { lut_done };
+	queue.enqueueReadBuffer(pipeline.output, CL_FALSE, 0, image_bytes, image.output.data(), &read_waits, &image.output_ready);
+	pipeline.cumulative_histogram_used = lut_built;
+	pipeline.image_used = pipeline.lut_used = lut_done;
+	pipeline.output_used = image.output_ready;
+
+	if (trace) {
+		const string suffix = " [" + to_string(image.index) + "]";
+		trace->Record(track, "lut_reciprocal" + suffix, reciprocal_done);
+		trace->Record(track, "lut_build_reciprocal" + suffix, lut_built);
+		trace->Record(track, worker.plan.lut + suffix, lut_done);
+		trace->Record(track, "read output" + suffix, image.output_ready);
+	}
+}
+
+//Equalises a batch of images, every worker (e.g. one per NUMA node) runs its own host thread and takes the next images
+//off the list as soon as it is done with the last ones. Each worker keeps images_in_flight pipelines (buffers and kernels), each
+//with the whole event chain of one image queued, and refills a pipeline with the next image as soon as its output has arrived
+//(a completion callback wakes the thread), so the device never waits for the saving and loading of the other images.
+//With an out-of-order queue the runtime can also overlap the kernels of different images. That fills a big CPU device much better
+//than one small image at a time. The outputs are saved next to the inputs.
+//The program of every worker is built for one bit depth (taken from the last -f image), images with a different bit depth are skipped.
+//With a trace every worker gets a track, the commands are tagged with the index of their image.
+template <typename T>
+void EqualiseBatch(vector<DeviceWorker>& workers, const vector<string>& file_names, int nr_bins, int bit_depth, int images_in_flight, CommandTrace* trace = NULL) {
+	atomic<size_t> next_image(0);
+	vector<size_t> images_done(workers.size(), 0);
+	vector<exception_ptr> errors(workers.size());
+	mutex output_mutex;
+	vector<int> tracks(workers.size(), 0);
+	if (trace) {
+		for (size_t w = 0; w < workers.size(); w++)
+			tracks[w] = trace->AddTrack(workers[w].caps.name + " [" + to_string(w) + "]", workers[w].out_of_order ? "out-of-order queue" : "in-order queue", workers[w].queue);
+	}
+
+	//pipelines whose image has finished (slot, status), filled from the callbacks. Shared so a callback that runs after its worker
+	//has given up on an error still has something to write to.
+	struct Finished {
+		mutex lock;
+		condition_variable changed;
+		vector<pair<size_t, cl_int>> slots;
+	};
+
+	auto start = chrono::steady_clock::now();
+	vector<thread> threads;
+	for (size_t w = 0; w < workers.size(); w++) {
+		threads.emplace_back([&, w]() {
+			try {
+				DeviceWorker& worker = workers[w];
+				vector<WorkerPipeline> pipelines;
+				for (int k = 0; k < images_in_flight; k++)
+					pipelines.push_back(CreatePipeline(worker, nr_bins, bit_depth));
+				vector<BatchImage<T>> images(images_in_flight);
+				auto finished = make_shared<Finished>();
+
+				//loads the next image of the list into pipeline k and queues its whole chain, false once the list is done
+				auto start_image = [&](size_t k) {
+					for (size_t i = next_image++; i < file_names.size(); i = next_image++) {
+						int max_pixel_value = GetPnmMaxValue(file_names[i]);
+						if (GetBitDepth(max_pixel_value) != bit_depth) {
+							lock_guard<mutex> lock(output_mutex);
+							std::cerr << "Skipping " << file_names[i] << ", the batch is " << bit_depth << "-bit" << std::endl;
+							continue;
+						}
+						BatchImage<T>& image = images[k];
+						image = BatchImage<T>();
+						image.index = i;
+						image.start = chrono::steady_clock::now();
+						image.input = ReadImage<T>(file_names[i], max_pixel_value);
+						EnqueueHistogramStage(worker, pipelines[k], image, nr_bins, bit_depth, trace, tracks[w]);
+						EnqueueLutStage(worker, pipelines[k], image, nr_bins, bit_depth, trace, tracks[w]);
+						SetCompletionCallback(image.output_ready, [finished, k](cl_int status) {
+							lock_guard<mutex> lock(finished->lock);
+							finished->slots.push_back(make_pair(k, status));
+							finished->changed.notify_one();
+						});
+						worker.queue.flush();
+						return true;
+					}
+					return false;
+				};
+
+				size_t in_flight = 0;
+				for (size_t k = 0; k < images.size() && start_image(k); k++)
+					in_flight++;
+				while (in_flight > 0) {
+					pair<size_t, cl_int> slot;
+					{
+						unique_lock<mutex> lock(finished->lock);
+						finished->changed.wait(lock, [&]() { return !finished->slots.empty(); });
+						slot = finished->slots.front();
+						finished->slots.erase(finished->slots.begin());
+					}
+					if (slot.second != CL_COMPLETE)
+						throw cl::Error(slot.second, "EqualiseBatch: queued command failed");
+					BatchImage<T>& image = images[slot.first];
+					image.output.save(GetOutputFileName(file_names[image.index]).c_str());
+					images_done[w]++;
+					{
+						lock_guard<mutex> lock(output_mutex);
+						std::cout << worker.caps.name << " [" << w << "]: " << file_names[image.index] << " -> " << GetOutputFileName(file_names[image.index]) << " ("
+							<< chrono::duration<double, milli>(chrono::steady_clock::now() - image.start).count() << " ms)" << std::endl;
+					}
+					if (!start_image(slot.first))
+						in_flight--;
+				}
+			}
+			catch (...) {
+				errors[w] = current_exception();
+				//the images of the other pipelines are still referenced by queued commands
+				try {
+					workers[w].queue.finish();
+				}
+				catch (...) {
+				}
+			}
+		});
+	}
+	for (thread& t : threads)
+		t.join();
+	for (const exception_ptr& error : errors) {
+		if (error)
+			rethrow_exception(error);
+	}
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	size_t total_images = 0;
+	for (size_t w = 0; w < workers.size(); w++) {
+		std::cout << workers[w].caps.name << " [" << w << "]: " << images_done[w] << " image(s)" << std::endl;
+		total_images += images_done[w];
+	}
+	std::cout << total_images << " image(s) in " << seconds << " s, " << total_images / max(seconds, 1e-9) << " images/s" << std::endl;
+}
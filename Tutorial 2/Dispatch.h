@@ -0,0 +1,381 @@
+#pragma once
+
+#include "Utils.h"
+#ifdef EMBEDDED_KERNELS
+#include "kernels_cl.h" //generated from kernels.cl by cmake/EmbedFile.cmake
+#endif
+#ifdef EMBEDDED_SPIRV
+#include "kernels_uchar_spv.h" //kernels.cl compiled offline to SPIR-V for each set of build options (see CMakeLists.txt)
+#include "kernels_ushort_spv.h"
+#include "kernels_uchar_subgroups_spv.h"
+#include "kernels_ushort_subgroups_spv.h"
+#endif
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+//CL_DEVICE_IL_VERSION is OpenCL 2.1 (and cl_khr_il_program), the headers are only used at the 1.2 level
+#ifndef CL_DEVICE_IL_VERSION
+#define CL_DEVICE_IL_VERSION 0x105B
+#endif
+
+//Largest bin count for the histogram_private kernel, has to match PRIVATE_BINS in kernels.cl
+const int PRIVATE_BINS = 32;
+
+//What the kernel choice depends on, read once per device
+struct DeviceCaps {
+	string name;
+	cl_device_type type;
+	cl_uint compute_units;
+	size_t max_work_group_size;
+	cl_ulong local_mem_size;
+	bool local_mem_dedicated; //CL_LOCAL, otherwise local memory is emulated in global memory
+	bool local_atomics; //cl_khr_local_int32_base_atomics or OpenCL C 1.1+
+	cl_uint vector_width_char; //preferred vector widths of the 8 and 16-bit pixel types
+	cl_uint vector_width_short;
+	bool intel_subgroups;
+	bool khr_subgroups;
+	bool subgroups; //the sub-group kernels can be built: the Intel extension, or cl_khr_subgroups with OpenCL C 2.0 or later
+	bool unified_memory; //device and host share memory, so buffers can wrap host pointers without a copy
+	string il_version; //e.g. "SPIR-V_1.2", empty if the device only takes OpenCL C source
+	bool il_program; //clCreateProgramWithIL or clCreateProgramWithILKHR could be found
+	string il_entry_point; //which of the two, or why neither (for --explain)
+	string opencl_c_version;
+	bool image_support; //CL_DEVICE_IMAGE_SUPPORT
+	bool image_r8; //CL_R images of the 8 and 16-bit formats of GetLutImageFormat can be read and written
+	bool image_r16;
+	size_t image2d_max_width;
+	size_t image2d_max_height;
+	size_t image_max_buffer_size; //largest 1D image on top of a buffer, in pixels
+};
+
+//The kernels picked for one image configuration, plus the reasons for --explain
+struct KernelPlan {
+	string histogram;
+	string scan;
+	string lut;
+	bool zero_copy;
+	vector<string> reasons;
+};
+
+//Formats of lut_apply_image, one component of the pixel type. 8-bit pixels are normalised (the format every device with images
+//handles best), 16-bit ones stay integers since CL_UNORM_INT16 would not keep all 65536 values through a float.
+inline cl::ImageFormat GetLutImageFormat(int bit_depth) {
+	return cl::ImageFormat(CL_R, bit_depth > 8 ? CL_UNSIGNED_INT16 : CL_UNORM_INT8);
+}
+
+//CL_R is not among the formats OpenCL 1.2 requires, so it is looked up for every kind of image lut_apply_image uses
+inline bool SupportsLutImageFormat(const cl::Context& context, int bit_depth) {
+	const cl::ImageFormat format = GetLutImageFormat(bit_depth);
+	const pair<cl_mem_flags, cl_mem_object_type> uses[] = { { CL_MEM_READ_ONLY, CL_MEM_OBJECT_IMAGE2D }, { CL_MEM_WRITE_ONLY, CL_MEM_OBJECT_IMAGE2D },
+		{ CL_MEM_READ_ONLY, CL_MEM_OBJECT_IMAGE1D_BUFFER } };
+	for (const auto& use : uses) {
+		vector<cl::ImageFormat> formats;
+		context.getSupportedImageFormats(use.first, use.second, &formats);
+		bool found = false;
+		for (const cl::ImageFormat& supported : formats)
+			found = found || (supported.image_channel_order == format.image_channel_order && supported.image_channel_data_type == format.image_channel_data_type);
+		if (!found)
+			return false;
+	}
+	return true;
+}
+
+typedef cl_program(CL_API_CALL* CreateProgramWithILFunction)(cl_context, const void*, size_t, cl_int*);
+
+//Function exported by the OpenCL library (ICD loader) the program is linked against, looked up by name so the binary still links
+//against a 1.2 loader that does not have it. NULL if the loader does not export it.
+inline void* GetLoaderFunction(const char* name) {
+#ifdef _WIN32
+	HMODULE loader = GetModuleHandleA("OpenCL.dll");
+	return loader != NULL ? (void*)GetProcAddress(loader, name) : NULL;
+#else
+	return dlsym(RTLD_DEFAULT, name);
+#endif
+}
+
+//clCreateProgramWithIL is core from OpenCL 2.1, so on those platforms it comes from the ICD loader (clGetExtensionFunctionAddressForPlatform
+//is only specified for extension functions). clCreateProgramWithILKHR is used where cl_khr_il_program is listed.
+//used says which one, or why there is none.
+inline CreateProgramWithILFunction GetCreateProgramWithIL(const cl::Device& device, string& used) {
+	cl::Platform platform(device.getInfo<CL_DEVICE_PLATFORM>());
+	string version = platform.getInfo<CL_PLATFORM_VERSION>();
+	int major = 0, minor = 0;
+	bool core = sscanf(version.c_str(), "OpenCL %d.%d", &major, &minor) == 2 && (major > 2 || (major == 2 && minor >= 1));
+	if (core) {
+		CreateProgramWithILFunction create = (CreateProgramWithILFunction)GetLoaderFunction("clCreateProgramWithIL");
+		if (create != NULL) {
+			used = "clCreateProgramWithIL (core, from the OpenCL library)";
+			return create;
+		}
+	}
+	string extensions = device.getInfo<CL_DEVICE_EXTENSIONS>() + " " + platform.getInfo<CL_PLATFORM_EXTENSIONS>();
+	bool khr = extensions.find("cl_khr_il_program") != string::npos;
+	if (khr) {
+		CreateProgramWithILFunction create = (CreateProgramWithILFunction)clGetExtensionFunctionAddressForPlatform(platform(), "clCreateProgramWithILKHR");
+		if (create != NULL) {
+			used = "clCreateProgramWithILKHR (cl_khr_il_program)";
+			return create;
+		}
+	}
+	used = string("none: ") + (core ? "the OpenCL library does not export clCreateProgramWithIL" : "the platform is older than OpenCL 2.1")
+		+ (khr ? ", clCreateProgramWithILKHR could not be found" : ", no cl_khr_il_program");
+	return NULL;
+}
+
+inline DeviceCaps ProbeDevice(const cl::Device& device) {
+	DeviceCaps caps;
+	string extensions = device.getInfo<CL_DEVICE_EXTENSIONS>();
+	caps.name = device.getInfo<CL_DEVICE_NAME>();
+	caps.type = device.getInfo<CL_DEVICE_TYPE>();
+	caps.compute_units = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+	caps.max_work_group_size = device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+	caps.local_mem_size = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+	caps.local_mem_dedicated = device.getInfo<CL_DEVICE_LOCAL_MEM_TYPE>() == CL_LOCAL;
+	caps.opencl_c_version = device.getInfo<CL_DEVICE_OPENCL_C_VERSION>();
+	//core since OpenCL C 1.1, an extension before that
+	caps.local_atomics = extensions.find("cl_khr_local_int32_base_atomics") != string::npos || caps.opencl_c_version.find("OpenCL C 1.0") == string::npos;
+	caps.vector_width_char = device.getInfo<CL_DEVICE_PREFERRED_VECTOR_WIDTH_CHAR>();
+	caps.vector_width_short = device.getInfo<CL_DEVICE_PREFERRED_VECTOR_WIDTH_SHORT>();
+	caps.intel_subgroups = extensions.find("cl_intel_subgroups") != string::npos;
+	caps.khr_subgroups = extensions.find("cl_khr_subgroups") != string::npos;
+	//the khr built-ins are OpenCL C 2.0 functions, the Intel ones also work in 1.2
+	caps.subgroups = caps.intel_subgroups || (caps.khr_subgroups && caps.opencl_c_version.find("OpenCL C 1.") == string::npos);
+	caps.unified_memory = device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>() == CL_TRUE;
+	//queried through the C API since the 1.2 bindings do not know about it, 1.2 devices without cl_khr_il_program just fail the call
+	char il_version[256] = {};
+	if (clGetDeviceInfo(device(), CL_DEVICE_IL_VERSION, sizeof(il_version) - 1, il_version, NULL) == CL_SUCCESS)
+		caps.il_version = il_version;
+	caps.il_program = GetCreateProgramWithIL(device, caps.il_entry_point) != NULL;
+	caps.image_support = device.getInfo<CL_DEVICE_IMAGE_SUPPORT>() == CL_TRUE;
+	caps.image_r8 = caps.image_r16 = false;
+	caps.image2d_max_width = caps.image2d_max_height = caps.image_max_buffer_size = 0;
+	if (caps.image_support) {
+		caps.image2d_max_width = device.getInfo<CL_DEVICE_IMAGE2D_MAX_WIDTH>();
+		caps.image2d_max_height = device.getInfo<CL_DEVICE_IMAGE2D_MAX_HEIGHT>();
+		caps.image_max_buffer_size = device.getInfo<CL_DEVICE_IMAGE_MAX_BUFFER_SIZE>();
+		//the supported formats are a property of a context, a throwaway one on this device is enough
+		cl::Context context(device);
+		caps.image_r8 = SupportsLutImageFormat(context, 8);
+		caps.image_r16 = SupportsLutImageFormat(context, 16);
+	}
+	return caps;
+}
+
+//Source of kernels.cl, compiled into the binary by the CMake build (EMBEDDED_KERNELS) so nothing is read at startup.
+//The Visual Studio projects copy kernels.cl next to the executable instead and it is read from the working directory.
+inline void AddKernelSources(cl::Program::Sources& sources) {
+#ifdef EMBEDDED_KERNELS
+	sources.push_back(string(kernels_cl, sizeof(kernels_cl) - 1));
+#else
+	AddSources(sources, "kernels.cl");
+#endif
+}
+
+//Offline compiled SPIR-V of kernels.cl matching GetBuildOptions, one module per pixel type with and without sub-groups.
+//The sub-group modules are built like GetBuildOptions builds for cl_khr_subgroups (-cl-std=CL2.0), there is none for the
+//Intel extension, so those devices get an empty name and build from source.
+inline string GetKernelILName(const DeviceCaps& caps, int bit_depth) {
+	string name = bit_depth > 8 ? "kernels_ushort" : "kernels_uchar";
+	if (caps.subgroups && caps.intel_subgroups)
+		return "";
+	if (caps.subgroups)
+		name += "_subgroups";
+	return name + ".spv";
+}
+
+//The module compiled into the binary (EMBEDDED_SPIRV) or a .spv file in the working directory, empty if there is neither
+inline vector<char> LoadKernelIL(const string& name) {
+#ifdef EMBEDDED_SPIRV
+	if (name == "kernels_uchar.spv")
+		return vector<char>(kernels_uchar_spv, kernels_uchar_spv + sizeof(kernels_uchar_spv) - 1);
+	if (name == "kernels_ushort.spv")
+		return vector<char>(kernels_ushort_spv, kernels_ushort_spv + sizeof(kernels_ushort_spv) - 1);
+	if (name == "kernels_uchar_subgroups.spv")
+		return vector<char>(kernels_uchar_subgroups_spv, kernels_uchar_subgroups_spv + sizeof(kernels_uchar_subgroups_spv) - 1);
+	if (name == "kernels_ushort_subgroups.spv")
+		return vector<char>(kernels_ushort_subgroups_spv, kernels_ushort_subgroups_spv + sizeof(kernels_ushort_subgroups_spv) - 1);
+#endif
+	ifstream file(name, ios::binary);
+	if (!file.is_open())
+		return vector<char>();
+	return vector<char>(istreambuf_iterator<char>(file), (istreambuf_iterator<char>()));
+}
+
+//Program from SPIR-V through GetCreateProgramWithIL, looked up at runtime so the program still links against 1.2 runtimes.
+//Returns an empty program if the platform has neither entry point.
+inline cl::Program CreateProgramWithIL(const cl::Context& context, const cl::Device& device, const vector<char>& il) {
+	string used;
+	CreateProgramWithILFunction create = GetCreateProgramWithIL(device, used);
+	if (create == NULL)
+		return cl::Program();
+	cl_int error = CL_SUCCESS;
+	cl_program program = create(context(), il.data(), il.size(), &error);
+	if (error != CL_SUCCESS)
+		return cl::Program();
+	return cl::Program(program);
+}
+
+//Build options for kernels.cl on this device
+inline string GetBuildOptions(const DeviceCaps& caps, int bit_depth) {
+	string build_options = bit_depth > 8 ? "-DPIXEL=ushort" : "-DPIXEL=uchar";
+	//Sub-group functions come either from cl_khr_subgroups (built as OpenCL C 2.0) or from the Intel extension,
+	//without them the plain atomic_inc kernels are used
+	if (caps.subgroups)
+		build_options += " -DUSE_SUBGROUPS";
+	if (caps.subgroups && !caps.intel_subgroups)
+		build_options += " -cl-std=CL2.0";
+	return build_options;
+}
+
+//Builds the kernels for one device, from offline compiled SPIR-V when the device takes it (no OpenCL C compile, so the first frame
+//costs the same on every driver) and from source otherwise or if the SPIR-V module is missing or rejected.
+//A source build with sub-groups that the compiler rejects is tried again without them, caps.subgroups is cleared then,
+//so the kernels have to be chosen after the build.
+inline cl::Program BuildKernelProgram(const cl::Context& context, const cl::Device& device, DeviceCaps& caps, int bit_depth,
+	const cl::Program::Sources& sources) {
+	if (caps.il_version.find("SPIR-V") != string::npos) {
+		string il_name = GetKernelILName(caps, bit_depth);
+		vector<char> il = il_name.empty() ? vector<char>() : LoadKernelIL(il_name);
+		cl::Program program = il.empty() ? cl::Program() : CreateProgramWithIL(context, device, il);
+		if (program() != NULL) {
+			try {
+				program.build({ device }, ""); //the -D options were applied when the module was compiled
+				return program;
+			}
+			catch (const cl::Error&) {
+				std::cout << "SPIR-V build failed on " << caps.name << ", building from source:\t " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << std::endl;
+			}
+		}
+	}
+
+	cl::Program program(context, sources);
+	try {
+		program.build({ device }, GetBuildOptions(caps, bit_depth).c_str());
+	}
+	catch (const cl::Error& err) {
+		std::cout << "Build Log (" << caps.name << "):\t " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << std::endl;
+		if (!caps.subgroups)
+			throw err;
+		std::cout << "Building again without sub-groups" << std::endl;
+		caps.subgroups = false;
+		return BuildKernelProgram(context, device, caps, bit_depth, sources);
+	}
+	return program;
+}
+
+//Picks the histogram, scan and LUT kernels for a device and image configuration
+//width, height and channels of the images let the LUT stage go through images (lut_apply_image), callers that run the kernels on
+//buffers leave them out and get one of the buffer kernels
+inline KernelPlan ChooseKernels(const DeviceCaps& caps, int nr_bins, int bit_depth, size_t width = 0, size_t height = 0, int channels = 1) {
+	KernelPlan plan;
+	stringstream reason;
+	bool bins_fit_local = sizeof(cl_uint) * nr_bins <= caps.local_mem_size;
+
+	//histogram: private counters for small bin counts, a local histogram whenever the bins fit (with sub-group aggregated atomics
+	//if the device has them) and global atomics otherwise
+	if (nr_bins <= PRIVATE_BINS) {
+		plan.histogram = "histogram_private";
+		reason << nr_bins << " bins fit into private counters (<= " << PRIVATE_BINS << ")";
+	}
+	else if (!caps.local_atomics) {
+		plan.histogram = "histogram_global";
+		reason << "no local atomics (cl_khr_local_int32_base_atomics)";
+	}
+	else if (!bins_fit_local) {
+		plan.histogram = "histogram_global";
+		reason << nr_bins << " bins need " << sizeof(cl_uint) * nr_bins << " B, only " << caps.local_mem_size << " B of local memory";
+	}
+	else if (caps.subgroups) {
+		plan.histogram = "histogram_subgroup";
+		reason << "bins fit into local memory and sub-groups are supported (" << (caps.intel_subgroups ? "cl_intel_subgroups" : "cl_khr_subgroups") << ")";
+	}
+	else {
+		plan.histogram = "histogram_local";
+		reason << "bins fit into local memory, no sub-group support";
+	}
+	if (!caps.local_mem_dedicated && plan.histogram != "histogram_global")
+		reason << ", local memory is emulated in global memory on this device";
+	plan.reasons.push_back("histogram: " + plan.histogram + " - " + reason.str());
+
+	//scan: a single pass in local memory when there is a work item per bin, the blocked scan otherwise
+	reason.str("");
+	if ((size_t)nr_bins <= caps.max_work_group_size && bins_fit_local) {
+		plan.scan = "scan_local";
+		reason << nr_bins << " bins <= max work group size " << caps.max_work_group_size << " and fit into local memory";
+	}
+	else if ((size_t)nr_bins > caps.max_work_group_size) {
+		plan.scan = "scan_blocked";
+		reason << nr_bins << " bins > max work group size " << caps.max_work_group_size;
+	}
+	else {
+		plan.scan = "scan_blocked";
+		reason << nr_bins << " bins need " << sizeof(cl_uint) * nr_bins << " B, only " << caps.local_mem_size << " B of local memory";
+	}
+	plan.reasons.push_back("scan: " + plan.scan + " - " + reason.str());
+
+	//LUT: through images on devices with a texture cache (not CPUs, which emulate images) if the formats are there and the image and the
+	//LUT fit the size limits, otherwise vector loads and stores if the device prefers vectors of the pixel type
+	reason.str("");
+	cl_uint vector_width = bit_depth > 8 ? caps.vector_width_short : caps.vector_width_char;
+	const size_t levels = (size_t)1 << bit_depth;
+	if (width == 0)
+		reason << "buffers only, ";
+	else if (!caps.image_support)
+		reason << "no image support, ";
+	else if (caps.type & CL_DEVICE_TYPE_CPU)
+		reason << "images are emulated on CPUs, ";
+	else if (!(bit_depth > 8 ? caps.image_r16 : caps.image_r8))
+		reason << "no CL_R " << (bit_depth > 8 ? "CL_UNSIGNED_INT16" : "CL_UNORM_INT8") << " images, ";
+	else if (width > caps.image2d_max_width || height * channels > caps.image2d_max_height)
+		reason << width << "x" << height * channels << " image over the 2D image limit " << caps.image2d_max_width << "x" << caps.image2d_max_height << ", ";
+	else if (levels * channels > caps.image_max_buffer_size)
+		reason << levels * channels << " LUT values over the 1D image limit " << caps.image_max_buffer_size << ", ";
+	else
+		plan.lut = "lut_apply_image";
+	if (plan.lut.empty()) {
+		plan.lut = vector_width >= 4 ? "lut_apply_vec" : "lut_apply";
+		reason << "preferred vector width " << vector_width << (bit_depth > 8 ? " (short)" : " (char)");
+	}
+	else {
+		reason << "image support, LUT as a " << levels * channels << " value 1D image";
+	}
+	plan.reasons.push_back("lut: " + plan.lut + " - " + reason.str());
+
+	//buffers: wrap the host images on devices that share memory with the host instead of copying them
+	plan.zero_copy = caps.unified_memory;
+	plan.reasons.push_back(string("buffers: ") + (plan.zero_copy ? "zero copy (CL_MEM_USE_HOST_PTR) - host unified memory" : "copied - device has its own memory"));
+	return plan;
+}
+
+//Printed by --explain
+inline string ExplainPlan(const DeviceCaps& caps, const KernelPlan& plan) {
+	stringstream sstream;
+	sstream << "Device: " << caps.name << endl;
+	sstream << "  compute units: " << caps.compute_units << ", max work group size: " << caps.max_work_group_size << endl;
+	sstream << "  local memory: " << caps.local_mem_size << " B" << (caps.local_mem_dedicated ? "" : " (emulated)")
+		<< ", local atomics: " << (caps.local_atomics ? "yes" : "no") << endl;
+	sstream << "  preferred vector width char/short: " << caps.vector_width_char << "/" << caps.vector_width_short << endl;
+	sstream << "  sub-groups: " << (caps.intel_subgroups ? "cl_intel_subgroups" : (caps.khr_subgroups ? "cl_khr_subgroups" : "no"))
+		<< (caps.khr_subgroups && !caps.subgroups ? " (not used, the built-ins need OpenCL C 2.0)" : "")
+		<< ", unified memory: " << (caps.unified_memory ? "yes" : "no") << endl;
+	sstream << "  images: " << (caps.image_support ? "yes" : "no");
+	if (caps.image_support)
+		sstream << " (2D up to " << caps.image2d_max_width << "x" << caps.image2d_max_height << ", 1D buffer up to " << caps.image_max_buffer_size
+			<< ", CL_R 8/16-bit: " << (caps.image_r8 ? "yes" : "no") << "/" << (caps.image_r16 ? "yes" : "no") << ")";
+	sstream << endl;
+	string il_name = GetKernelILName(caps, 8);
+	sstream << "  program: " << (caps.il_version.find("SPIR-V") == string::npos ? "source"
+		: il_name.empty() ? "source (no SPIR-V module for cl_intel_subgroups)"
+		: !caps.il_program ? "source (" + caps.il_version + " but " + caps.il_entry_point + ")"
+		: "SPIR-V (" + caps.il_version + ") through " + caps.il_entry_point + " if the module is there, source otherwise") << endl;
+	sstream << "Kernel choice:" << endl;
+	for (const string& reason : plan.reasons)
+		sstream << "  " << reason << endl;
+	return sstream.str();
+}
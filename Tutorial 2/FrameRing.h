@@ -0,0 +1,206 @@
+#pragma once
+
+//Ring of frame slots in POSIX shared memory (shm_open), so a producer process can hand frames to the equalisation service
+//without writing image files. No OpenCL in here, the producer includes this header on its own.
+//
+//Layout: the header and the slot table, then slot_count slots of slot_stride bytes starting at data_offset. Every slot has
+//an input area followed by an output area of slot_bytes each, both aligned to FRAME_RING_ALIGNMENT so the service can wrap
+//them as CL_MEM_USE_HOST_PTR buffers. Pixels are stored like CImg does it, one channel after another, 8-bit values as
+//one byte and anything deeper as two (native byte order).
+//
+//Handoff: the producer fills the input of a free slot, sets it to FRAME_READY and sends "frame<TAB>ring<TAB>slot" to the
+//service (see Socket.h). The service writes the output and sets FRAME_DONE (or FRAME_FAILED) before it replies.
+//The producer reads the output and sets the slot back to FRAME_FREE.
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+const uint32_t FRAME_RING_MAGIC = 0x52514548; //"HEQR"
+const size_t FRAME_RING_ALIGNMENT = 4096;
+
+enum FrameState : uint32_t {
+	FRAME_FREE = 0,
+	FRAME_READY = 1,
+	FRAME_DONE = 2,
+	FRAME_FAILED = 3
+};
+
+struct FrameSlot {
+	std::atomic<uint32_t> state;
+	uint32_t width;
+	uint32_t height;
+	uint32_t channels;
+	uint32_t bit_depth; //1-16
+	uint32_t nr_bins; //0 = whatever the service was started with
+	uint64_t sequence; //frame number of the producer, left alone by the service
+};
+
+struct FrameRingHeader {
+	uint32_t magic;
+	uint32_t slot_count;
+	uint64_t slot_bytes; //size of the input and of the output area of a slot
+	uint64_t slot_stride;
+	uint64_t data_offset;
+};
+
+//A mapped ring, on either side. layout is a copy of the header taken when the ring was created or checked by OpenFrameRing,
+//the slots are found through it since the shared header can be changed by the other process at any time.
+struct FrameRing {
+	std::string name;
+	FrameRingHeader* header = nullptr;
+	FrameRingHeader layout = {};
+	size_t size = 0;
+};
+
+inline size_t AlignFrameRing(size_t bytes) {
+	return (bytes + FRAME_RING_ALIGNMENT - 1) / FRAME_RING_ALIGNMENT * FRAME_RING_ALIGNMENT;
+}
+
+//Bytes of pixel data of a frame, false if the size does not fit into a size_t (the fields come from another process)
+inline bool GetFrameBytes(uint32_t width, uint32_t height, uint32_t channels, uint32_t bit_depth, size_t& bytes) {
+	uint64_t total = 1;
+	for (uint64_t factor : { (uint64_t)width, (uint64_t)height, (uint64_t)channels, (uint64_t)(bit_depth > 8 ? 2 : 1) }) {
+		if (factor != 0 && total > SIZE_MAX / factor)
+			return false;
+		total *= factor;
+	}
+	bytes = (size_t)total;
+	return true;
+}
+
+//Frame description of a slot, copied out of shared memory once so it cannot change between checking and using it.
+//bytes is 0 if the size of the frame does not fit into a size_t.
+struct FrameInfo {
+	uint32_t width;
+	uint32_t height;
+	uint32_t channels;
+	uint32_t bit_depth;
+	uint32_t nr_bins;
+	size_t bytes;
+};
+
+inline FrameInfo GetFrameInfo(const FrameSlot& slot) {
+	FrameInfo frame;
+	frame.width = slot.width;
+	frame.height = slot.height;
+	frame.channels = slot.channels;
+	frame.bit_depth = slot.bit_depth;
+	frame.nr_bins = slot.nr_bins;
+	if (!GetFrameBytes(frame.width, frame.height, frame.channels, frame.bit_depth, frame.bytes))
+		frame.bytes = 0;
+	return frame;
+}
+
+//Slot numbers have to be below layout.slot_count, the callers check that
+inline FrameSlot& GetFrameSlot(const FrameRing& ring, uint32_t slot) {
+	return reinterpret_cast<FrameSlot*>(ring.header + 1)[slot];
+}
+
+inline unsigned char* GetFrameInput(const FrameRing& ring, uint32_t slot) {
+	return reinterpret_cast<unsigned char*>(ring.header) + ring.layout.data_offset + slot * ring.layout.slot_stride;
+}
+
+inline unsigned char* GetFrameOutput(const FrameRing& ring, uint32_t slot) {
+	return GetFrameInput(ring, slot) + AlignFrameRing(ring.layout.slot_bytes);
+}
+
+//Whether the layout a header describes fits into size bytes: the slot table before data_offset, and slot_count slots of an
+//input and an output area each. Every sum and product is checked against size before it is formed, so a damaged or hostile
+//header cannot overflow its way past the checks.
+inline bool IsValidFrameRing(const FrameRingHeader& header, size_t size) {
+	if (header.magic != FRAME_RING_MAGIC || header.slot_count == 0 || size < sizeof(FrameRingHeader))
+		return false;
+	if (header.slot_count > (size - sizeof(FrameRingHeader)) / sizeof(FrameSlot))
+		return false;
+	if (header.data_offset < sizeof(FrameRingHeader) + (uint64_t)header.slot_count * sizeof(FrameSlot) || header.data_offset > size)
+		return false;
+	if (header.slot_bytes > size / 2 || AlignFrameRing(header.slot_bytes) > size / 2 || header.slot_stride < 2 * AlignFrameRing(header.slot_bytes))
+		return false;
+	return header.slot_stride <= (size - header.data_offset) / header.slot_count;
+}
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <new>
+
+inline void CloseFrameRing(FrameRing& ring, bool remove = false) {
+	if (ring.header != nullptr)
+		munmap(ring.header, ring.size);
+	if (remove)
+		shm_unlink(ring.name.c_str());
+	ring.header = nullptr;
+	ring.size = 0;
+}
+
+//Producer side: creates (or replaces) the shared memory object, e.g. name "/camera0", with all slots free
+inline bool CreateFrameRing(FrameRing& ring, const std::string& name, uint32_t slot_count, size_t slot_bytes) {
+	if (slot_count == 0 || slot_bytes > SIZE_MAX / 4 || slot_count > (SIZE_MAX / 2 - FRAME_RING_ALIGNMENT) / sizeof(FrameSlot))
+		return false;
+	size_t data_offset = AlignFrameRing(sizeof(FrameRingHeader) + sizeof(FrameSlot) * slot_count);
+	size_t slot_stride = 2 * AlignFrameRing(slot_bytes);
+	if (slot_stride > (SIZE_MAX - data_offset) / slot_count)
+		return false;
+	size_t size = data_offset + slot_stride * slot_count;
+
+	int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+	if (fd < 0)
+		return false;
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		return false;
+	}
+	void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (memory == MAP_FAILED)
+		return false;
+
+	ring.name = name;
+	ring.size = size;
+	ring.header = static_cast<FrameRingHeader*>(memory);
+	ring.header->slot_count = slot_count;
+	ring.header->slot_bytes = slot_bytes;
+	ring.header->slot_stride = slot_stride;
+	ring.header->data_offset = data_offset;
+	ring.layout = *ring.header;
+	ring.layout.magic = FRAME_RING_MAGIC;
+	for (uint32_t i = 0; i < slot_count; i++) {
+		FrameSlot* slot = new (&GetFrameSlot(ring, i)) FrameSlot();
+		slot->state = FRAME_FREE;
+	}
+	std::atomic_thread_fence(std::memory_order_release);
+	ring.header->magic = FRAME_RING_MAGIC; //last, so a half initialised ring is never opened
+	return true;
+}
+
+//Service side: maps an existing ring, false if it does not exist or is not a frame ring
+inline bool OpenFrameRing(FrameRing& ring, const std::string& name) {
+	int fd = shm_open(name.c_str(), O_RDWR, 0);
+	if (fd < 0)
+		return false;
+	struct stat info;
+	if (fstat(fd, &info) < 0 || (size_t)info.st_size < sizeof(FrameRingHeader)) {
+		close(fd);
+		return false;
+	}
+	void* memory = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (memory == MAP_FAILED)
+		return false;
+
+	ring.name = name;
+	ring.size = info.st_size;
+	ring.header = static_cast<FrameRingHeader*>(memory);
+	//checked and used from a private copy, the producer can still write the shared header
+	memcpy(&ring.layout, ring.header, sizeof(FrameRingHeader));
+	if (!IsValidFrameRing(ring.layout, ring.size)) {
+		CloseFrameRing(ring);
+		return false;
+	}
+	return true;
+}
+#endif
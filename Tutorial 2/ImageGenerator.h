@@ -0,0 +1,173 @@
+#pragma once
+
+//Synthetic test images with a chosen value distribution, for benchmarking (see generate_image.cpp for the command line tool).
+//The histogram kernels are very sensitive to the content: a constant image sends every work item to the same bin
+//(worst case for atomic contention) while uniform noise spreads them out, and natural images are somewhere in between.
+
+#include <random>
+#include <cmath>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include "CImg.h"
+
+using namespace cimg_library;
+
+enum class Distribution {
+	Uniform, //every value equally likely
+	Gaussian, //normal around the middle of the range
+	Constant, //a single value, every pixel in the same bin
+	Bimodal, //two normal peaks at a quarter and three quarters of the range
+	Natural, //spatially correlated 1/f noise, smooth regions and edges like a photo
+};
+
+inline const char* GetDistributionName(Distribution distribution) {
+	switch (distribution) {
+	case Distribution::Uniform: return "uniform";
+	case Distribution::Gaussian: return "gaussian";
+	case Distribution::Constant: return "constant";
+	case Distribution::Bimodal: return "bimodal";
+	case Distribution::Natural: return "natural";
+	}
+	return "unknown";
+}
+
+inline bool ParseDistribution(const std::string& name, Distribution& distribution) {
+	for (Distribution d : { Distribution::Uniform, Distribution::Gaussian, Distribution::Constant, Distribution::Bimodal, Distribution::Natural }) {
+		if (name == GetDistributionName(d)) {
+			distribution = d;
+			return true;
+		}
+	}
+	return false;
+}
+
+//1/f noise as a sum of octaves of value noise: random values on a grid, bilinearly interpolated, every octave has half the grid step
+//and half the amplitude of the one before (amplitude proportional to the wavelength, i.e. a 1/f spectrum).
+//The octaves stop at a grid step of 4 pixels so the grids stay small even for 200 MP frames. Values come out around 0.5, clamped to [0, 1].
+class NaturalNoise {
+public:
+	NaturalNoise(size_t width, size_t height, std::mt19937& generator) {
+		std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+		double variance = 0;
+		for (size_t step = std::max(width, height) / 2; step >= 4; step /= 2) {
+			Octave octave;
+			octave.step = step;
+			octave.amplitude = (float)step;
+			octave.columns = width / step + 2;
+			octave.values.resize(octave.columns * (height / step + 2));
+			for (float& value : octave.values)
+				value = distribution(generator);
+			variance += (double)octave.amplitude * octave.amplitude / 3.0;
+			octaves_.push_back(octave);
+		}
+		scale_ = variance > 0 ? (float)(1.0 / (6.0 * std::sqrt(variance))) : 0.0f; //+-3 sigma over the range
+	}
+
+	float operator()(size_t x, size_t y) const {
+		float sum = 0;
+		for (const Octave& octave : octaves_) {
+			size_t gx = x / octave.step, gy = y / octave.step;
+			float fx = (float)(x % octave.step) / octave.step, fy = (float)(y % octave.step) / octave.step;
+			const float* row = &octave.values[gy * octave.columns + gx];
+			const float* next_row = row + octave.columns;
+			float top = row[0] + (row[1] - row[0]) * fx;
+			float bottom = next_row[0] + (next_row[1] - next_row[0]) * fx;
+			sum += (top + (bottom - top) * fy) * octave.amplitude;
+		}
+		return std::min(1.0f, std::max(0.0f, 0.5f + sum * scale_));
+	}
+
+private:
+	struct Octave {
+		size_t step = 0;
+		size_t columns = 0;
+		float amplitude = 0;
+		std::vector<float> values;
+	};
+	std::vector<Octave> octaves_;
+	float scale_ = 0;
+};
+
+//width x height image with the given number of channels, values from 0 to 2^bit_depth - 1 (T has to hold them).
+//Every channel gets its own random values, the same seed always gives the same image.
+template <typename T>
+CImg<T> GenerateImage(size_t width, size_t height, int channels, int bit_depth, Distribution distribution, unsigned int seed = 1) {
+	CImg<T> image((unsigned int)width, (unsigned int)height, 1, channels);
+	const double max_value = (double)((1u << bit_depth) - 1);
+	std::mt19937 generator(seed);
+	auto clamp_value = [max_value](double value) { return (T)std::min(max_value, std::max(0.0, std::round(value))); };
+
+	for (int c = 0; c < channels; c++) {
+		T* data = image.data(0, 0, 0, c);
+		const size_t size = width * height;
+		switch (distribution) {
+		case Distribution::Uniform: {
+			std::uniform_int_distribution<unsigned int> values(0, (unsigned int)max_value);
+			for (size_t i = 0; i < size; i++)
+				data[i] = (T)values(generator);
+			break;
+		}
+		case Distribution::Gaussian: {
+			std::normal_distribution<double> values(max_value / 2, max_value / 8);
+			for (size_t i = 0; i < size; i++)
+				data[i] = clamp_value(values(generator));
+			break;
+		}
+		case Distribution::Constant: {
+			for (size_t i = 0; i < size; i++)
+				data[i] = (T)(max_value / 2);
+			break;
+		}
+		case Distribution::Bimodal: {
+			std::normal_distribution<double> low(max_value / 4, max_value / 16), high(max_value * 3 / 4, max_value / 16);
+			std::bernoulli_distribution pick_high(0.5);
+			for (size_t i = 0; i < size; i++)
+				data[i] = clamp_value(pick_high(generator) ? high(generator) : low(generator));
+			break;
+		}
+		case Distribution::Natural: {
+			NaturalNoise noise(width, height, generator);
+			for (size_t y = 0; y < height; y++) {
+				for (size_t x = 0; x < width; x++)
+					data[y * width + x] = clamp_value(noise(x, y) * max_value);
+			}
+			break;
+		}
+		}
+	}
+	return image;
+}
+
+//Binary PNM (P5 mono, P6 colour) with the max value of the bit depth in the header, so GetPnmMaxValue reads the bit depth back
+//even if the image does not use the whole range. 16-bit values are big endian as the format requires.
+template <typename T>
+bool WritePnm(const std::string& file_name, const CImg<T>& image, int bit_depth) {
+	if (image.spectrum() != 1 && image.spectrum() != 3) {
+		std::cerr << "Only mono and colour images can be written as PNM" << std::endl;
+		return false;
+	}
+	std::ofstream file(file_name, std::ios::binary);
+	if (!file.is_open()) {
+		std::cerr << "Unable to write " << file_name << std::endl;
+		return false;
+	}
+	const unsigned int max_value = (1u << bit_depth) - 1;
+	file << (image.spectrum() == 1 ? "P5" : "P6") << "\n" << image.width() << " " << image.height() << "\n" << max_value << "\n";
+
+	//interleaved pixels, one row at a time
+	std::vector<unsigned char> row((size_t)image.width() * image.spectrum() * (max_value > 255 ? 2 : 1));
+	for (int y = 0; y < image.height(); y++) {
+		size_t i = 0;
+		for (int x = 0; x < image.width(); x++) {
+			for (int c = 0; c < image.spectrum(); c++) {
+				unsigned int value = (unsigned int)image(x, y, 0, c);
+				if (max_value > 255)
+					row[i++] = (unsigned char)(value >> 8);
+				row[i++] = (unsigned char)(value & 0xFF);
+			}
+		}
+		file.write((const char*)row.data(), row.size());
+	}
+	return (bool)file;
+}
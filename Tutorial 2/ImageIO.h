@@ -0,0 +1,54 @@
+#pragma once
+
+#include "Utils.h"
+#include "CImg.h"
+
+using namespace cimg_library;
+
+//Reads the maximum value out of a PNM header (P2, P3, P5, P6) so we know the bit depth of the image.
+//Anything else is treated as 8-bit.
+inline int GetPnmMaxValue(const string& file_name) {
+	ifstream file(file_name, ios::binary);
+	string magic;
+	file >> magic;
+	if (magic != "P2" && magic != "P3" && magic != "P5" && magic != "P6")
+		return 255;
+
+	int values[3] = { 0, 0, 255 }; //width, height, max value
+	for (int i = 0; i < 3 && file;) {
+		file >> ws;
+		if (file.peek() == '#') { //skip comments such as "# Created by IrfanView"
+			string comment;
+			getline(file, comment);
+			continue;
+		}
+		file >> values[i++];
+	}
+	return values[2] > 0 ? values[2] : 255;
+}
+
+//Loads an image, values above the max value in the header (e.g. in 12-bit data) are clamped so they cannot fall outside the bins
+template <typename T>
+CImg<T> ReadImage(const string& file_name, int max_pixel_value) {
+	CImg<T> image(file_name.c_str());
+	if (max_pixel_value < (int)cimg::type<T>::max())
+		image.min((T)max_pixel_value);
+	return image;
+}
+
+//Smallest bit depth that holds the max value, e.g. 255 -> 8, 4095 -> 12, 65535 -> 16
+inline int GetBitDepth(int max_pixel_value) {
+	int bit_depth = 1;
+	while ((1 << bit_depth) <= max_pixel_value)
+		bit_depth++;
+	return bit_depth;
+}
+
+//Where batch mode saves an output, next to the input with _equalised added (images/a.pgm -> images/a_equalised.pgm)
+inline string GetOutputFileName(const string& file_name) {
+	size_t dot = file_name.find_last_of('.');
+	size_t slash = file_name.find_last_of("/\\");
+	if (dot == string::npos || (slash != string::npos && dot < slash))
+		return file_name + "_equalised";
+	return file_name.substr(0, dot) + "_equalised" + file_name.substr(dot);
+}
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <chrono>
+#include <numeric>
+#include "Utils.h"
+#include "CImg.h"
+#include "Tuning.h"
+#include "Dispatch.h"
+#include "Pipeline.h"
+#include "Trace.h"
+
+using namespace cimg_library;
+
+//One device taking part in a multi-device run, with its own queue, program and kernel plan.
+//Every device gets a band of rows (first_row, rows) of every channel.
+struct DeviceWorker {
+	cl::Context context;
+	cl::Device device;
+	cl::CommandQueue queue;
+	cl::Program program;
+	DeviceCaps caps;
+	KernelPlan plan;
+	TuningTable tuning;
+	bool out_of_order = false; //the queue runs commands in any order, every command has to list what it waits for
+	double pixels_per_second = 0; //measured by CalibrateWorkers
+	size_t first_row = 0;
+	size_t rows = 0;
+};
+
+//Sets up a worker for every device of the given contexts. The program is built separately for each device
+//because the build options (sub-groups) depend on the device. Out-of-order queues are only used where the device supports them.
+inline vector<DeviceWorker> CreateWorkers(const vector<cl::Context>& contexts, int nr_bins, int bit_depth, bool out_of_order = false) {
+	cl::Program::Sources sources;
+	AddKernelSources(sources);
+
+	vector<DeviceWorker> workers;
+	for (const cl::Context& context : contexts) {
+		for (const cl::Device& device : context.getInfo<CL_CONTEXT_DEVICES>()) {
+			DeviceWorker worker;
+			worker.context = context;
+			worker.device = device;
+			cl_command_queue_properties properties = CL_QUEUE_PROFILING_ENABLE;
+			worker.out_of_order = out_of_order && (device.getInfo<CL_DEVICE_QUEUE_PROPERTIES>() & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) != 0;
+			if (worker.out_of_order)
+				properties |= CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+			worker.queue = cl::CommandQueue(context, device, properties);
+			worker.caps = ProbeDevice(device);
+			worker.tuning.file_name = GetTuningFileName(device);
+			LoadTuning(worker.tuning);
+
+			worker.program = BuildKernelProgram(context, device, worker.caps, bit_depth, sources);
+			worker.plan = ChooseKernels(worker.caps, nr_bins, bit_depth); //after the build, it can turn sub-groups off
+			workers.push_back(worker);
+		}
+	}
+	return workers;
+}
+
+//Settings from the tuning file of the device, or defaults if it was never tuned (run once in single device mode to tune it)
+inline LaunchConfig GetWorkerConfig(const DeviceWorker& worker, const cl::Kernel& kernel, const string& kernel_name, int bit_depth, int nr_bins) {
+	LaunchConfig default_config;
+	size_t kernel_work_group_size = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(worker.device);
+	default_config.work_group_size = min(kernel_work_group_size, (size_t)256);
+	if (kernel_name == "histogram_private")
+		default_config.pixels_per_item = 64;
+	return FindLaunchConfig(worker.tuning, GetTuningKey(kernel_name, bit_depth, nr_bins), default_config);
+}
+
+//Times every device on the same band of the image (about 1M pixels of the first channel, upload and histogram kernel)
+//so the rows can be split in proportion to what each device actually manages, transfers included.
+template <typename T>
+void CalibrateWorkers(vector<DeviceWorker>& workers, const CImg<T>& image_input, int nr_bins, int bit_depth) {
+	const size_t width = image_input.width();
+	const size_t total_rows = (size_t)image_input.height() * image_input.depth();
+	const size_t rows = min(total_rows, max((size_t)1, ((size_t)1 << 20) / width));
+	const size_t pixels = rows * width;
+	cl_uint bin_mul, bin_shift;
+	GetBinMapping(nr_bins, bit_depth, bin_mul, bin_shift);
+
+	for (DeviceWorker& worker : workers) {
+		cl::Buffer dev_image(worker.context, CL_MEM_READ_ONLY, pixels * sizeof(T));
+		cl::Buffer dev_histogram(worker.context, CL_MEM_READ_WRITE, sizeof(cl_uint) * nr_bins);
+		cl::Kernel kernel(worker.program, worker.plan.histogram.c_str());
+		LaunchConfig config = GetWorkerConfig(worker, kernel, worker.plan.histogram, bit_depth, nr_bins);
+
+		//the first run pays for one-off costs (e.g. lazy kernel compilation), the second one is kept
+		double seconds = 0;
+		for (int run = 0; run < 2; run++) {
+			auto start = chrono::steady_clock::now();
+			worker.queue.enqueueWriteBuffer(dev_image, CL_FALSE, 0, pixels * sizeof(T), image_input.data());
+			worker.queue.enqueueFillBuffer(dev_histogram, (cl_uint)0, 0, sizeof(cl_uint) * nr_bins);
+			EnqueueHistogram(worker.queue, kernel, worker.plan.histogram, dev_image, dev_histogram, pixels, 1, nr_bins, bin_mul, bin_shift, config);
+			worker.queue.finish();
+			seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		}
+		worker.pixels_per_second = pixels / max(seconds, 1e-9);
+	}
+}
+
+//Splits the rows in proportion to the measured throughput, the last device takes whatever is left after rounding
+inline void SplitRows(vector<DeviceWorker>& workers, size_t total_rows) {
+	double total = 0;
+	for (const DeviceWorker& worker : workers)
+		total += worker.pixels_per_second;
+
+	size_t first_row = 0;
+	for (size_t i = 0; i < workers.size(); i++) {
+		workers[i].first_row = first_row;
+		workers[i].rows = (i + 1 == workers.size()) ? total_rows - first_row : (size_t)(total_rows * workers[i].pixels_per_second / total);
+		first_row += workers[i].rows;
+	}
+}
+
+//Equalises one image over several devices: every device builds the histogram of its band of rows, the partial histograms are
+//merged and scanned on the host (at most a few thousand bins) and the LUT is then applied by all devices in parallel.
+//With a trace every device gets a track with the commands of both passes (the calibration runs are left out).
+template <typename T>
+CImg<T> EqualiseMultiDevice(vector<DeviceWorker>& workers, const CImg<T>& image_input, int nr_bins, int bit_depth, CommandTrace* trace = NULL) {
+	const int channels = image_input.spectrum();
+	const size_t width = image_input.width();
+	const size_t total_rows = (size_t)image_input.height() * image_input.depth(); //CImg keeps the slices of a channel one after another
+	const size_t channel_size = width * total_rows;
+	const size_t levels = (size_t)1 << bit_depth;
+	const size_t histogram_size = (size_t)nr_bins * channels;
+	cl_uint bin_mul, bin_shift;
+	GetBinMapping(nr_bins, bit_depth, bin_mul, bin_shift);
+
+	CalibrateWorkers(workers, image_input, nr_bins, bit_depth);
+	SplitRows(workers, total_rows);
+	vector<int> tracks(workers.size(), 0);
+	if (trace) {
+		for (size_t w = 0; w < workers.size(); w++)
+			tracks[w] = trace->AddTrack(workers[w].caps.name + " [" + to_string(w) + "]", "queue", workers[w].queue);
+	}
+	//records the command of the event if there is a trace
+	auto record = [&](size_t w, const string& name, const cl::Event& event) {
+		if (trace)
+			trace->Record(tracks[w], name, event);
+	};
+
+	//per device buffers, a band holds the same rows of every channel one channel after another
+	struct Band {
+		cl::Buffer image, output, histogram, lut;
+		cl::Kernel histogram_kernel, lut_kernel;
+		vector<unsigned int> partial_histogram;
+	};
+	vector<Band> bands(workers.size());
+
+	//1. upload the bands and build the partial histograms, all devices at once
+	for (size_t w = 0; w < workers.size(); w++) {
+		DeviceWorker& worker = workers[w];
+		Band& band = bands[w];
+		if (worker.rows == 0)
+			continue;
+		const size_t band_size = worker.rows * width;
+
+		band.image = cl::Buffer(worker.context, CL_MEM_READ_ONLY, band_size * channels * sizeof(T));
+		band.output = cl::Buffer(worker.context, CL_MEM_WRITE_ONLY, band_size * channels * sizeof(T));
+		band.histogram = cl::Buffer(worker.context, CL_MEM_READ_WRITE, sizeof(cl_uint) * histogram_size);
+		band.lut = cl::Buffer(worker.context, CL_MEM_READ_ONLY, sizeof(T) * levels * channels);
+		band.histogram_kernel = cl::Kernel(worker.program, worker.plan.histogram.c_str());
+		band.lut_kernel = cl::Kernel(worker.program, worker.plan.lut.c_str());
+		band.partial_histogram.resize(histogram_size);
+
+		cl::Event event;
+		for (int c = 0; c < channels; c++) {
+			worker.queue.enqueueWriteBuffer(band.image, CL_FALSE, c * band_size * sizeof(T), band_size * sizeof(T),
+				image_input.data() + c * channel_size + worker.first_row * width, NULL, &event);
+			record(w, "write band, channel " + to_string(c), event);
+		}
+		worker.queue.enqueueFillBuffer(band.histogram, (cl_uint)0, 0, sizeof(cl_uint) * histogram_size, NULL, &event);
+		record(w, "fill histogram", event);
+		LaunchConfig config = GetWorkerConfig(worker, band.histogram_kernel, worker.plan.histogram, bit_depth, nr_bins);
+		event = EnqueueHistogram(worker.queue, band.histogram_kernel, worker.plan.histogram, band.image, band.histogram, band_size, channels, nr_bins, bin_mul, bin_shift, config);
+		record(w, worker.plan.histogram, event);
+		worker.queue.enqueueReadBuffer(band.histogram, CL_FALSE, 0, sizeof(cl_uint) * histogram_size, band.partial_histogram.data(), NULL, &event);
+		record(w, "read partial histogram", event);
+		worker.queue.flush();
+	}
+	for (DeviceWorker& worker : workers)
+		worker.queue.finish();
+
+	//2. merge the partial histograms and scan every channel on the host
+	vector<unsigned int> cumulative_histogram(histogram_size, 0);
+	for (const Band& band : bands) {
+		for (size_t i = 0; i < band.partial_histogram.size(); i++)
+			cumulative_histogram[i] += band.partial_histogram[i];
+	}
+	for (int c = 0; c < channels; c++) {
+		auto channel_begin = cumulative_histogram.begin() + (size_t)c * nr_bins;
+		partial_sum(channel_begin, channel_begin + nr_bins, channel_begin);
+	}
+	vector<T> lut = BuildLut<T>(cumulative_histogram, channels, nr_bins, bit_depth);
+
+	//3. apply the LUT to every band in parallel and copy the bands back into place
+	CImg<T> image_output(image_input.width(), image_input.height(), image_input.depth(), channels);
+	for (size_t w = 0; w < workers.size(); w++) {
+		DeviceWorker& worker = workers[w];
+		Band& band = bands[w];
+		if (worker.rows == 0)
+			continue;
+		const size_t band_size = worker.rows * width;
+
+		cl::Event event;
+		worker.queue.enqueueWriteBuffer(band.lut, CL_FALSE, 0, sizeof(T) * lut.size(), lut.data(), NULL, &event);
+		record(w, "write LUT", event);
+		LaunchConfig config = GetWorkerConfig(worker, band.lut_kernel, worker.plan.lut, bit_depth, nr_bins);
+		event = EnqueueLut(worker.queue, band.lut_kernel, worker.plan.lut, band.image, band.output, band.lut, band_size, channels, levels, config);
+		record(w, worker.plan.lut, event);
+		for (int c = 0; c < channels; c++) {
+			worker.queue.enqueueReadBuffer(band.output, CL_FALSE, c * band_size * sizeof(T), band_size * sizeof(T),
+				image_output.data() + c * channel_size + worker.first_row * width, NULL, &event);
+			record(w, "read band, channel " + to_string(c), event);
+		}
+		worker.queue.flush();
+	}
+	for (DeviceWorker& worker : workers)
+		worker.queue.finish();
+
+	for (const DeviceWorker& worker : workers) {
+		std::cout << worker.caps.name << ": rows " << worker.first_row << "-" << worker.first_row + worker.rows
+			<< " (" << (size_t)(worker.pixels_per_second / 1e6) << " MP/s calibrated, " << worker.plan.histogram << ", " << worker.plan.lut << ")" << std::endl;
+	}
+	return image_output;
+}
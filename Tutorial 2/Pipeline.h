@@ -0,0 +1,234 @@
+#pragma once
+
+#include "Utils.h"
+#include "Tuning.h"
+
+//bin = value * nr_bins >> bit_depth, precomputed once for the kernels and the look up table.
+//Common powers of two are cancelled so a power of two bin count turns into a plain shift.
+inline void GetBinMapping(int nr_bins, int bit_depth, cl_uint& bin_mul, cl_uint& bin_shift) {
+	bin_mul = nr_bins;
+	bin_shift = bit_depth;
+	while (bin_shift > 0 && (bin_mul % 2) == 0) {
+		bin_mul /= 2;
+		bin_shift--;
+	}
+}
+
+//Sets the arguments of one of the histogram kernels and launches it over channel_size / pixels_per_item work items per channel.
+//wait_events is only needed on out-of-order queues, see Batch.h
+inline cl::Event EnqueueHistogram(cl::CommandQueue& queue, cl::Kernel& kernel, const string& kernel_name, const cl::Buffer& image, const cl::Buffer& histogram,
+	size_t channel_size, int channels, int nr_bins, cl_uint bin_mul, cl_uint bin_shift, const LaunchConfig& config, const vector<cl::Event>* wait_events = NULL) {
+	size_t local_work_size = config.work_group_size;
+	int arg = 0;
+	kernel.setArg(arg++, image);
+	kernel.setArg(arg++, histogram);
+	if (kernel_name == "histogram_local")
+		kernel.setArg(arg++, cl::Local(sizeof(cl_uint) * nr_bins * config.replicas));
+	else if (kernel_name == "histogram_subgroup")
+		kernel.setArg(arg++, cl::Local(sizeof(cl_uint) * nr_bins));
+	else if (kernel_name == "histogram_private")
+		kernel.setArg(arg++, cl::Local(sizeof(cl_uint) * local_work_size)); //reduction scratch
+	kernel.setArg(arg++, (cl_uint)channel_size);
+	kernel.setArg(arg++, (cl_uint)nr_bins);
+	kernel.setArg(arg++, bin_mul);
+	kernel.setArg(arg++, bin_shift);
+	if (kernel_name == "histogram_local")
+		kernel.setArg(arg++, config.replicas);
+
+	size_t work_items = (channel_size + config.pixels_per_item - 1) / config.pixels_per_item;
+	size_t global_size = (work_items + local_work_size - 1) / local_work_size * local_work_size; //padded to a multiple of the work group
+	cl::Event event;
+	queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(global_size, channels), cl::NDRange(local_work_size, 1), wait_events, &event);
+	return event;
+}
+
+//Cumulative histogram, a single work group per channel (scan_local needs exactly nr_bins work items)
+inline cl::Event EnqueueScan(cl::CommandQueue& queue, cl::Kernel& kernel, const cl::Buffer& histogram, const cl::Buffer& cumulative_histogram,
+	int channels, int nr_bins, const LaunchConfig& config, const vector<cl::Event>* wait_events = NULL) {
+	kernel.setArg(0, histogram);
+	kernel.setArg(1, cumulative_histogram);
+	kernel.setArg(2, cl::Local(sizeof(cl_uint) * config.work_group_size));
+	kernel.setArg(3, (cl_uint)nr_bins);
+	cl::Event event;
+	queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(config.work_group_size, channels), cl::NDRange(config.work_group_size, 1), wait_events, &event);
+	return event;
+}
+
+//Look up table on the device, lut_apply_vec does 4 pixels per work item
+inline cl::Event EnqueueLut(cl::CommandQueue& queue, cl::Kernel& kernel, const string& kernel_name, const cl::Buffer& image, const cl::Buffer& output, const cl::Buffer& lut,
+	size_t channel_size, int channels, size_t levels, const LaunchConfig& config, const vector<cl::Event>* wait_events = NULL) {
+	kernel.setArg(0, image);
+	kernel.setArg(1, output);
+	kernel.setArg(2, lut);
+	kernel.setArg(3, (cl_uint)channel_size);
+	kernel.setArg(4, (cl_uint)levels);
+
+	size_t pixels_per_item = kernel_name == "lut_apply_vec" ? 4 : 1;
+	size_t work_items = (channel_size + pixels_per_item - 1) / pixels_per_item;
+	size_t global_size = (work_items + config.work_group_size - 1) / config.work_group_size * config.work_group_size;
+	cl::Event event;
+	queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(global_size, channels), cl::NDRange(config.work_group_size, 1), wait_events, &event);
+	return event;
+}
+
+//LUT application through images (lut_apply_image), image and output hold the channels stacked into height * channels rows
+//and lut is the LUT buffer seen as a 1D image. A work item per pixel, rows are not padded.
+inline cl::Event EnqueueLutImage(cl::CommandQueue& queue, cl::Kernel& kernel, const cl::Image2D& image, const cl::Image2D& output, const cl::Image1DBuffer& lut,
+	size_t width, size_t height, int channels, size_t levels, const LaunchConfig& config, const vector<cl::Event>* wait_events = NULL) {
+	kernel.setArg(0, image);
+	kernel.setArg(1, output);
+	kernel.setArg(2, lut);
+	kernel.setArg(3, (cl_uint)height);
+	kernel.setArg(4, (cl_uint)levels);
+
+	size_t global_size = (width + config.work_group_size - 1) / config.work_group_size * config.work_group_size;
+	cl::Event event;
+	queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(global_size, height * channels), cl::NDRange(config.work_group_size, 1), wait_events, &event);
+	return event;
+}
+
+//Look up table from the cumulative histogram on the device (lut_build), one work item per possible pixel value of every channel
+inline cl::Event EnqueueLutBuild(cl::CommandQueue& queue, cl::Kernel& kernel, const cl::Buffer& cumulative_histogram, const cl::Buffer& lut,
+	int channels, int nr_bins, size_t levels, cl_uint bin_mul, cl_uint bin_shift, const vector<cl::Event>* wait_events = NULL) {
+	kernel.setArg(0, cumulative_histogram);
+	kernel.setArg(1, lut);
+	kernel.setArg(2, (cl_uint)nr_bins);
+	kernel.setArg(3, (cl_uint)levels);
+	kernel.setArg(4, bin_mul);
+	kernel.setArg(5, bin_shift);
+	cl::Event event;
+	queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(levels, channels), cl::NullRange, wait_events, &event);
+	return event;
+}
+
+//Look up table without a division per entry: lut_reciprocal works out cdf_min and a reciprocal of the range of every channel
+//(reciprocals has to hold 4 ulongs per channel), then lut_build_reciprocal multiplies with it. Returns the event of the second kernel,
+//which waits for the first one on out-of-order queues as well, the one of lut_reciprocal goes to reciprocal_event if given.
+inline cl::Event EnqueueLutBuildReciprocal(cl::CommandQueue& queue, cl::Kernel& reciprocal_kernel, cl::Kernel& build_kernel, const cl::Buffer& cumulative_histogram,
+	const cl::Buffer& reciprocals, const cl::Buffer& lut, int channels, int nr_bins, size_t levels, cl_uint bin_mul, cl_uint bin_shift, const vector<cl::Event>* wait_events = NULL,
+	cl::Event* reciprocal_event = NULL) {
+	reciprocal_kernel.setArg(0, cumulative_histogram);
+	reciprocal_kernel.setArg(1, reciprocals);
+	reciprocal_kernel.setArg(2, (cl_uint)nr_bins);
+	vector<cl::Event> build_waits(1);
+	queue.enqueueNDRangeKernel(reciprocal_kernel, cl::NullRange, cl::NDRange(channels), cl::NullRange, wait_events, &build_waits[0]);
+
+	build_kernel.setArg(0, cumulative_histogram);
+	build_kernel.setArg(1, reciprocals);
+	build_kernel.setArg(2, lut);
+	build_kernel.setArg(3, (cl_uint)nr_bins);
+	build_kernel.setArg(4, (cl_uint)levels);
+	build_kernel.setArg(5, bin_mul);
+	build_kernel.setArg(6, bin_shift);
+	cl::Event event;
+	queue.enqueueNDRangeKernel(build_kernel, cl::NullRange, cl::NDRange(levels, channels), cl::NullRange, &build_waits, &event);
+	if (reciprocal_event)
+		*reciprocal_event = build_waits[0];
+	return event;
+}
+
+//Work groups per slice for the batched kernels, enough for the largest slice to get about pixels_per_item pixels per work item
+inline size_t GetBatchedGlobalSize(size_t max_channel_size, const LaunchConfig& config) {
+	size_t pixels_per_group = config.work_group_size * config.pixels_per_item;
+	size_t groups = max((size_t)1, (max_channel_size + pixels_per_group - 1) / pixels_per_group);
+	return groups * config.work_group_size;
+}
+
+//histogram_batched over every slice (image * channels + channel) of a packed batch, histogram holds nr_bins values per slice and has to be zeroed
+inline cl::Event EnqueueHistogramBatched(cl::CommandQueue& queue, cl::Kernel& kernel, const cl::Buffer& images, const cl::Buffer& offsets, const cl::Buffer& histogram,
+	size_t slices, int channels, int nr_bins, cl_uint bin_mul, cl_uint bin_shift, size_t max_channel_size, const LaunchConfig& config, const vector<cl::Event>* wait_events = NULL) {
+	kernel.setArg(0, images);
+	kernel.setArg(1, offsets);
+	kernel.setArg(2, histogram);
+	kernel.setArg(3, cl::Local(sizeof(cl_uint) * nr_bins));
+	kernel.setArg(4, (cl_uint)channels);
+	kernel.setArg(5, (cl_uint)nr_bins);
+	kernel.setArg(6, bin_mul);
+	kernel.setArg(7, bin_shift);
+	cl::Event event;
+	queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(GetBatchedGlobalSize(max_channel_size, config), slices), cl::NDRange(config.work_group_size, 1), wait_events, &event);
+	return event;
+}
+
+//lut_apply_batched, lut holds levels entries per slice (e.g. from EnqueueLutBuild with channels = slices)
+inline cl::Event EnqueueLutBatched(cl::CommandQueue& queue, cl::Kernel& kernel, const cl::Buffer& images, const cl::Buffer& output, const cl::Buffer& offsets, const cl::Buffer& lut,
+	size_t slices, int channels, size_t levels, size_t max_channel_size, const LaunchConfig& config, const vector<cl::Event>* wait_events = NULL) {
+	kernel.setArg(0, images);
+	kernel.setArg(1, output);
+	kernel.setArg(2, offsets);
+	kernel.setArg(3, lut);
+	kernel.setArg(4, (cl_uint)channels);
+	kernel.setArg(5, (cl_uint)levels);
+	cl::Event event;
+	queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(GetBatchedGlobalSize(max_channel_size, config), slices), cl::NDRange(config.work_group_size, 1), wait_events, &event);
+	return event;
+}
+
+//High 64 bits of a 64 x 64-bit product (mul_hi in OpenCL C), from 32-bit halves so it works without 128-bit integers (MSVC)
+inline unsigned long long MulHi64(unsigned long long a, unsigned long long b) {
+	unsigned long long a_low = a & 0xFFFFFFFFull, a_high = a >> 32;
+	unsigned long long b_low = b & 0xFFFFFFFFull, b_high = b >> 32;
+	unsigned long long low_low = a_low * b_low, high_low = a_high * b_low, low_high = a_low * b_high;
+	unsigned long long middle = (low_low >> 32) + (high_low & 0xFFFFFFFFull) + (low_high & 0xFFFFFFFFull);
+	return a_high * b_high + (high_low >> 32) + (low_high >> 32) + (middle >> 32);
+}
+
+//Magic number and shift so that x / range == MulHi64(x, magic) >> shift for every x < 2^48, range >= 2.
+//Same long division as lut_reciprocal in kernels.cl, see there for why it is exact.
+inline void GetReciprocal(unsigned long long range, unsigned long long& magic, unsigned int& shift) {
+	unsigned int l = 0;
+	while ((1ull << l) < range)
+		l++;
+	magic = 0;
+	unsigned long long remainder = 0;
+	for (int bit = 63 + (int)l; bit >= 0; bit--) {
+		remainder = remainder * 2 + (bit == 63 + (int)l ? 1 : 0);
+		if (remainder >= range) {
+			remainder -= range;
+			if (bit < 64)
+				magic |= 1ull << bit;
+		}
+	}
+	if (remainder != 0)
+		magic++;
+	shift = l - 1;
+}
+
+//Normalises the cumulative histogram of every channel and expands it into the look up table,
+//one entry per possible pixel value for every channel so lut[channel * 2^bit_depth + value] can be used directly.
+//Same arithmetic as lut_build in kernels.cl: (cdf - cdf_min) * (levels - 1) / (total - cdf_min) rounded, in 64 bits
+//(32-bit counts times a 16-bit range overflow 32 bits from 65K pixels on for 16-bit images and 16.8 MP for 8-bit ones).
+//The division is done with a reciprocal of the range, like lut_build_reciprocal. A channel with every pixel in one bin keeps its values.
+template <typename T>
+vector<T> BuildLut(const vector<unsigned int>& cumulative_histogram, int channels, int nr_bins, int bit_depth) {
+	const size_t levels = (size_t)1 << bit_depth;
+	cl_uint bin_mul, bin_shift;
+	GetBinMapping(nr_bins, bit_depth, bin_mul, bin_shift);
+
+	vector<T> lut(levels * channels);
+	vector<T> normalised(nr_bins);
+	for (int c = 0; c < channels; ++c) {
+		const unsigned int* channel_histogram = &cumulative_histogram[(size_t)c * nr_bins];
+		int first = 0;
+		while (first < nr_bins - 1 && channel_histogram[first] == 0)
+			first++;
+		const unsigned long long cdf_min = channel_histogram[first];
+		const unsigned long long range = channel_histogram[nr_bins - 1] - cdf_min;
+		unsigned long long magic = 0;
+		unsigned int shift = 0;
+		if (range > 1)
+			GetReciprocal(range, magic, shift);
+		for (int i = 0; i < nr_bins; ++i) {
+			unsigned long long cdf = max((unsigned long long)channel_histogram[i], cdf_min);
+			unsigned long long x = (cdf - cdf_min) * (levels - 1) + range / 2;
+			normalised[i] = static_cast<T>(range > 1 ? MulHi64(x, magic) >> shift : x);
+		}
+
+		////LOOK UP TABLE!
+		for (size_t value = 0; value < levels; ++value) {
+			size_t bin = (value * bin_mul) >> bin_shift;
+			lut[c * levels + value] = range > 0 ? normalised[bin] : static_cast<T>(value);
+		}
+	}
+	return lut;
+}
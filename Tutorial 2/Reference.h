@@ -0,0 +1,94 @@
+#pragma once
+
+#include "Utils.h"
+#include "Pipeline.h"
+
+//Plain scalar versions of every step of the equalisation, one pixel or bin at a time, as the reference the kernels are checked against
+//(see Validate.h). The value to bin mapping and the LUT arithmetic are the ones the kernels use, so every kernel has to match exactly.
+//Channels are one after another, channel_size pixels each, like everywhere else.
+
+template <typename T>
+vector<unsigned int> ReferenceHistogram(const T* image, size_t channel_size, int channels, int nr_bins, int bit_depth) {
+	cl_uint bin_mul, bin_shift;
+	GetBinMapping(nr_bins, bit_depth, bin_mul, bin_shift);
+	vector<unsigned int> histogram((size_t)nr_bins * channels, 0);
+	for (int c = 0; c < channels; c++) {
+		const T* channel_image = image + (size_t)c * channel_size;
+		for (size_t i = 0; i < channel_size; i++)
+			histogram[(size_t)c * nr_bins + (((cl_uint)channel_image[i] * bin_mul) >> bin_shift)]++;
+	}
+	return histogram;
+}
+
+//Inclusive prefix sum of every channel
+inline vector<unsigned int> ReferenceCdf(const vector<unsigned int>& histogram, int channels, int nr_bins) {
+	vector<unsigned int> cdf(histogram.size());
+	for (int c = 0; c < channels; c++) {
+		unsigned int sum = 0;
+		for (int i = 0; i < nr_bins; i++) {
+			sum += histogram[(size_t)c * nr_bins + i];
+			cdf[(size_t)c * nr_bins + i] = sum;
+		}
+	}
+	return cdf;
+}
+
+//lut[channel * levels + value] = round((cdf[bin of value] - cdf_min) * (levels - 1) / (total - cdf_min)) in 64 bits, with cdf_min the count
+//of the first occupied bin and values below it going to 0. A channel with every pixel in one bin keeps its values.
+template <typename T>
+vector<T> ReferenceLut(const vector<unsigned int>& cdf, int channels, int nr_bins, int bit_depth) {
+	const size_t levels = (size_t)1 << bit_depth;
+	cl_uint bin_mul, bin_shift;
+	GetBinMapping(nr_bins, bit_depth, bin_mul, bin_shift);
+	vector<T> lut(levels * channels);
+	for (int c = 0; c < channels; c++) {
+		const unsigned int* channel_cdf = &cdf[(size_t)c * nr_bins];
+		unsigned long long cdf_min = 0;
+		for (int i = 0; i < nr_bins && cdf_min == 0; i++)
+			cdf_min = channel_cdf[i];
+		unsigned long long range = channel_cdf[nr_bins - 1] - cdf_min;
+		for (size_t value = 0; value < levels; value++) {
+			size_t bin = (value * bin_mul) >> bin_shift;
+			if (range == 0) {
+				lut[c * levels + value] = (T)value;
+				continue;
+			}
+			unsigned long long above_min = channel_cdf[bin] > cdf_min ? channel_cdf[bin] - cdf_min : 0;
+			lut[c * levels + value] = (T)((above_min * (levels - 1) + range / 2) / range);
+		}
+	}
+	return lut;
+}
+
+template <typename T>
+vector<T> ReferenceApply(const T* image, const vector<T>& lut, size_t channel_size, int channels, int bit_depth) {
+	const size_t levels = (size_t)1 << bit_depth;
+	vector<T> output(channel_size * channels);
+	for (int c = 0; c < channels; c++) {
+		for (size_t i = 0; i < channel_size; i++)
+			output[(size_t)c * channel_size + i] = lut[c * levels + image[(size_t)c * channel_size + i]];
+	}
+	return output;
+}
+
+//Empty if actual matches expected exactly, otherwise how many values differ, the first one and the largest difference
+template <typename T>
+string DiffExact(const vector<T>& expected, const vector<T>& actual) {
+	if (expected.size() != actual.size())
+		return "size " + to_string(actual.size()) + " instead of " + to_string(expected.size());
+	size_t differ = 0, first = 0;
+	long long max_difference = 0;
+	for (size_t i = 0; i < expected.size(); i++) {
+		if (expected[i] == actual[i])
+			continue;
+		if (differ++ == 0)
+			first = i;
+		max_difference = max(max_difference, llabs((long long)actual[i] - (long long)expected[i]));
+	}
+	if (differ == 0)
+		return "";
+	stringstream sstream;
+	sstream << differ << " of " << expected.size() << " differ, first at " << first << " (expected " << (unsigned long long)expected[first]
+		<< ", got " << (unsigned long long)actual[first] << "), largest difference " << max_difference;
+	return sstream.str();
+}
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <map>
+#include <tuple>
+#include <chrono>
+#include <cstdint>
+#include "Utils.h"
+#include "CImg.h"
+#include "MultiDevice.h"
+#include "Batch.h"
+#include "ImageIO.h"
+#include "Socket.h"
+#include "FrameRing.h"
+
+using namespace cimg_library;
+
+//The input and output areas of a frame ring slot as buffers of one device, created the first time the slot is used on that device
+struct FrameBuffers {
+	cl::Buffer input, output;
+	bool created = false;
+	bool zero_copy = false; //the buffers wrap the slot (CL_MEM_USE_HOST_PTR), otherwise the pipeline buffers and copies are used
+};
+
+//Everything the service keeps warm between jobs. The programs are built per bit depth (pixel type) and the kernel plan
+//depends on the bin count, so the workers and their pipelines are created the first time a combination comes in and kept.
+struct EqualiseService {
+	vector<cl::Context> contexts;
+	int nr_bins = 256; //used when a job does not give its own
+	map<pair<int, int>, vector<DeviceWorker>> workers; //key: bit depth, bins
+	map<pair<int, int>, vector<WorkerPipeline>> pipelines; //one per worker
+	size_t next_worker = 0; //jobs go round robin over the devices
+	map<string, FrameRing> rings; //shared memory rings stay mapped until a close request or the end of the service
+	map<tuple<string, uint32_t, size_t>, FrameBuffers> frame_buffers; //key: ring, slot, worker
+	size_t jobs_done = 0;
+};
+
+//Workers and pipelines for one bit depth and bin count, built on first use
+inline vector<DeviceWorker>& GetServiceWorkers(EqualiseService& service, int bit_depth, int nr_bins) {
+	pair<int, int> key(bit_depth, nr_bins);
+	auto entry = service.workers.find(key);
+	if (entry != service.workers.end())
+		return entry->second;
+
+	//both maps are only filled once everything is built, a build that throws half way leaves nothing behind to go out of step
+	vector<DeviceWorker> workers = CreateWorkers(service.contexts, nr_bins, bit_depth);
+	vector<WorkerPipeline> pipelines;
+	for (const DeviceWorker& worker : workers)
+		pipelines.push_back(CreatePipeline(worker, nr_bins, bit_depth));
+	std::cout << "Built " << bit_depth << "-bit pipelines for " << nr_bins << " bins on " << workers.size() << " device(s)" << std::endl;
+	service.pipelines[key] = pipelines;
+	return service.workers[key] = workers;
+}
+
+template <typename T>
+void EqualiseServiceImage(EqualiseService& service, const string& input, const string& output, int max_pixel_value, int bit_depth, int nr_bins) {
+	vector<DeviceWorker>& workers = GetServiceWorkers(service, bit_depth, nr_bins);
+	size_t w = service.next_worker++ % workers.size();
+
+	BatchImage<T> image;
+	image.input = ReadImage<T>(input, max_pixel_value);
+	WorkerPipeline& pipeline = service.pipelines[make_pair(bit_depth, nr_bins)][w];
+	EnqueueHistogramStage(workers[w], pipeline, image, nr_bins, bit_depth);
+	EnqueueLutStage(workers[w], pipeline, image, nr_bins, bit_depth);
+	image.output_ready.wait();
+	image.output.save(output.c_str());
+}
+
+#ifndef _WIN32
+//The slot areas are page aligned, which is enough for CL_MEM_USE_HOST_PTR on every device we know of, but the device has the last word
+//(CL_DEVICE_MEM_BASE_ADDR_ALIGN, in bits). Wrapping only pays off where the device shares memory with the host.
+inline bool CanWrapFrame(const DeviceWorker& worker, const void* data) {
+	size_t alignment = worker.device.getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>() / 8;
+	return worker.plan.zero_copy && (alignment == 0 || (uintptr_t)data % alignment == 0);
+}
+
+//Equalises the frame in a ring slot straight from shared memory into the output area of the slot. The frame description is the
+//copy HandleFrameRequest checked, not the slot itself, the producer could change that in the meantime.
+template <typename T>
+void EqualiseFrame(EqualiseService& service, const FrameRing& ring, uint32_t slot_id, const FrameInfo& frame, int nr_bins) {
+	const int bit_depth = (int)frame.bit_depth;
+	vector<DeviceWorker>& workers = GetServiceWorkers(service, bit_depth, nr_bins);
+	size_t w = service.next_worker++ % workers.size();
+	DeviceWorker& worker = workers[w];
+	WorkerPipeline& pipeline = service.pipelines[make_pair(bit_depth, nr_bins)][w];
+	cl::CommandQueue& queue = worker.queue;
+
+	const int channels = (int)frame.channels;
+	const size_t channel_size = (size_t)frame.width * frame.height;
+	const size_t levels = (size_t)1 << bit_depth;
+	const size_t image_bytes = frame.bytes;
+	const size_t histogram_size = (size_t)nr_bins * channels;
+	const size_t histogram_bytes = sizeof(cl_uint) * histogram_size;
+	T* input = reinterpret_cast<T*>(GetFrameInput(ring, slot_id));
+	T* output = reinterpret_cast<T*>(GetFrameOutput(ring, slot_id));
+	cl_uint bin_mul, bin_shift;
+	GetBinMapping(nr_bins, bit_depth, bin_mul, bin_shift);
+
+	FrameBuffers& buffers = service.frame_buffers[make_tuple(ring.name, slot_id, w)];
+	if (!buffers.created) {
+		buffers.zero_copy = CanWrapFrame(worker, input);
+		if (buffers.zero_copy) {
+			buffers.input = cl::Buffer(worker.context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, ring.layout.slot_bytes, input);
+			buffers.output = cl::Buffer(worker.context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, ring.layout.slot_bytes, output);
+		}
+		buffers.created = true;
+	}
+	ReservePipelineBuffers(worker, pipeline, buffers.zero_copy ? 0 : image_bytes, histogram_bytes, sizeof(T) * levels * channels);
+	const cl::Buffer& image_buffer = buffers.zero_copy ? buffers.input : pipeline.image;
+	const cl::Buffer& output_buffer = buffers.zero_copy ? buffers.output : pipeline.output;
+
+	if (buffers.zero_copy) {
+		//the producer wrote the slot from another process, mapping and unmapping hands the new contents over to the runtime
+		void* mapped = queue.enqueueMapBuffer(buffers.input, CL_TRUE, CL_MAP_WRITE, 0, image_bytes);
+		queue.enqueueUnmapMemObject(buffers.input, mapped);
+	}
+	else {
+		queue.enqueueWriteBuffer(pipeline.image, CL_FALSE, 0, image_bytes, input);
+	}
+	queue.enqueueFillBuffer(pipeline.histogram, (cl_uint)0, 0, histogram_bytes);
+	EnqueueHistogram(queue, pipeline.histogram_kernel, worker.plan.histogram, image_buffer, pipeline.histogram,
+		channel_size, channels, nr_bins, bin_mul, bin_shift, pipeline.histogram_config);
+	EnqueueScan(queue, pipeline.scan_kernel, pipeline.histogram, pipeline.cumulative_histogram, channels, nr_bins, pipeline.scan_config);
+
+	vector<unsigned int> cumulative_histogram(histogram_size);
+	queue.enqueueReadBuffer(pipeline.cumulative_histogram, CL_TRUE, 0, histogram_bytes, cumulative_histogram.data());
+	vector<T> lut = BuildLut<T>(cumulative_histogram, channels, nr_bins, bit_depth);
+
+	queue.enqueueWriteBuffer(pipeline.lut, CL_FALSE, 0, sizeof(T) * lut.size(), lut.data());
+	EnqueueLut(queue, pipeline.lut_kernel, worker.plan.lut, image_buffer, output_buffer, pipeline.lut, channel_size, channels, levels, pipeline.lut_config);
+	if (buffers.zero_copy) {
+		void* mapped = queue.enqueueMapBuffer(buffers.output, CL_TRUE, CL_MAP_READ, 0, image_bytes);
+		queue.enqueueUnmapMemObject(buffers.output, mapped);
+		queue.finish();
+	}
+	else {
+		queue.enqueueReadBuffer(pipeline.output, CL_TRUE, 0, image_bytes, output);
+	}
+}
+
+//"frame<TAB>ring<TAB>slot", the frame description (size, channels, bit depth, bins) is in the slot itself
+inline string HandleFrameRequest(EqualiseService& service, const vector<string>& fields) {
+	if (fields.size() < 3)
+		return "error\tframe needs a ring and a slot";
+	const string& name = fields[1];
+	if (service.rings.count(name) == 0) {
+		FrameRing ring;
+		if (!OpenFrameRing(ring, name))
+			return "error\tcannot open frame ring " + name;
+		service.rings[name] = ring;
+	}
+	const FrameRing& ring = service.rings[name];
+
+	uint32_t slot_id = (uint32_t)strtoul(fields[2].c_str(), NULL, 10);
+	if (slot_id >= ring.layout.slot_count)
+		return "error\tno slot " + fields[2] + " in " + name;
+	FrameSlot& slot = GetFrameSlot(ring, slot_id);
+	if (slot.state.load(memory_order_acquire) != FRAME_READY)
+		return "error\tslot " + fields[2] + " is not ready";
+
+	FrameInfo frame = GetFrameInfo(slot);
+	int bit_depth = (int)frame.bit_depth;
+	int nr_bins = frame.nr_bins != 0 ? (int)frame.nr_bins : service.nr_bins;
+	string error;
+	if (bit_depth < 1 || bit_depth > 16 || frame.channels < 1 || frame.width < 1 || frame.height < 1)
+		error = "bad frame description";
+	else if (frame.bytes == 0 || frame.bytes > ring.layout.slot_bytes)
+		error = "frame does not fit into the slot";
+	else if (nr_bins < 1 || nr_bins > (1 << bit_depth))
+		error = "number of bins has to be between 1 and " + to_string(1 << bit_depth);
+	if (!error.empty()) {
+		slot.state.store(FRAME_FAILED, memory_order_release);
+		return "error\t" + error;
+	}
+
+	auto start = chrono::steady_clock::now();
+	try {
+		if (bit_depth > 8)
+			EqualiseFrame<unsigned short>(service, ring, slot_id, frame, nr_bins);
+		else
+			EqualiseFrame<unsigned char>(service, ring, slot_id, frame, nr_bins);
+	}
+	catch (...) {
+		slot.state.store(FRAME_FAILED, memory_order_release);
+		throw;
+	}
+	slot.state.store(FRAME_DONE, memory_order_release);
+	service.jobs_done++;
+
+	stringstream reply;
+	reply << "ok\t" << name << ":" << slot_id << "\t" << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	return reply.str();
+}
+
+//Unmaps a ring and drops its buffers, needed before a producer recreates a ring under the same name
+inline string HandleCloseRequest(EqualiseService& service, const vector<string>& fields) {
+	if (fields.size() < 2 || service.rings.count(fields[1]) == 0)
+		return "error\tno such frame ring";
+	for (auto entry = service.frame_buffers.begin(); entry != service.frame_buffers.end();) {
+		if (get<0>(entry->first) == fields[1])
+			entry = service.frame_buffers.erase(entry);
+		else
+			++entry;
+	}
+	CloseFrameRing(service.rings[fields[1]]);
+	service.rings.erase(fields[1]);
+	return "ok";
+}
+#endif
+
+//Runs one request line and returns the reply line, see Socket.h for the protocol.
+//Errors in a job (missing file, bad bin count, OpenCL errors) only fail that job, the service keeps running.
+inline string HandleServiceRequest(EqualiseService& service, const string& request, bool& shutdown) {
+	vector<string> fields = SplitFields(request);
+	if (fields.empty())
+		return "error\tempty request";
+	if (fields[0] == "ping")
+		return "ok";
+	if (fields[0] == "shutdown") {
+		shutdown = true;
+		return "ok";
+	}
+	if (fields[0] == "frame" || fields[0] == "close") {
+#ifndef _WIN32
+		try {
+			return fields[0] == "frame" ? HandleFrameRequest(service, fields) : HandleCloseRequest(service, fields);
+		}
+		catch (const cl::Error& err) {
+			return string("error\t") + err.what() + ", " + getErrorString(err.err());
+		}
+		catch (const std::exception& err) {
+			return string("error\t") + err.what();
+		}
+#else
+		return "error\tframe rings are not available in the Windows build";
+#endif
+	}
+	if (fields[0] != "equalise" || fields.size() < 2)
+		return "error\tunknown request: " + request;
+
+	const string& input = fields[1];
+	string output = fields.size() > 2 && !fields[2].empty() ? fields[2] : GetOutputFileName(input);
+	int nr_bins = fields.size() > 3 ? atoi(fields[3].c_str()) : service.nr_bins;
+
+	try {
+		auto start = chrono::steady_clock::now();
+		if (!ifstream(input).good())
+			return "error\tcannot open " + input;
+		int max_pixel_value = GetPnmMaxValue(input);
+		int bit_depth = GetBitDepth(max_pixel_value);
+		if (nr_bins < 1 || nr_bins > (1 << bit_depth))
+			return "error\tnumber of bins has to be between 1 and " + to_string(1 << bit_depth);
+
+		if (bit_depth > 8)
+			EqualiseServiceImage<unsigned short>(service, input, output, max_pixel_value, bit_depth, nr_bins);
+		else
+			EqualiseServiceImage<unsigned char>(service, input, output, max_pixel_value, bit_depth, nr_bins);
+		service.jobs_done++;
+
+		stringstream reply;
+		reply << "ok\t" << output << "\t" << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		return reply.str();
+	}
+	catch (const cl::Error& err) {
+		return string("error\t") + err.what() + ", " + getErrorString(err.err());
+	}
+	catch (CImgException& err) {
+		return string("error\t") + err.what();
+	}
+	catch (const std::exception& err) { //e.g. bad_alloc for a huge image, the service keeps running
+		return string("error\t") + err.what();
+	}
+}
+
+#ifndef _WIN32
+//Accepts connections on the socket until a shutdown request comes in. Clients are served one after another and
+//every client can send any number of requests over its connection, the replies come back in the same order.
+inline bool RunService(EqualiseService& service, const string& socket_path) {
+	int server = ListenUnixSocket(socket_path);
+	if (server < 0) {
+		std::cerr << "Unable to listen on " << socket_path << ": " << strerror(errno) << std::endl;
+		return false;
+	}
+	std::cout << "Listening on " << socket_path << std::endl;
+
+	bool shutdown = false;
+	while (!shutdown) {
+		int client = accept(server, NULL, NULL);
+		if (client < 0) {
+			if (errno == EINTR)
+				continue;
+			std::cerr << "accept failed: " << strerror(errno) << std::endl;
+			break;
+		}
+
+		string buffer, request;
+		while (!shutdown && ReceiveLine(client, buffer, request)) {
+			string reply = HandleServiceRequest(service, request, shutdown);
+			std::cout << request << " -> " << reply << std::endl;
+			if (!SendLine(client, reply))
+				break;
+		}
+		close(client);
+	}
+
+	close(server);
+	unlink(socket_path.c_str());
+	for (auto& entry : service.rings)
+		CloseFrameRing(entry.second);
+	std::cout << service.jobs_done << " job(s) done" << std::endl;
+	return true;
+}
+#else
+inline bool RunService(EqualiseService&, const string&) {
+	std::cerr << "The equalisation service needs Unix domain sockets, it is not available in the Windows build" << std::endl;
+	return false;
+}
+#endif
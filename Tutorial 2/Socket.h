@@ -0,0 +1,118 @@
+#pragma once
+
+//Unix domain socket helpers shared by the equalisation service (--serve) and equalise_client.
+//No OpenCL in here so the client stays a small standalone program.
+//The protocol is one request per line, tab separated fields, and one reply line per request:
+//  equalise<TAB>input path[<TAB>output path[<TAB>nr_bins]]  ->  ok<TAB>output path<TAB>milliseconds  or  error<TAB>message
+//  frame<TAB>ring<TAB>slot  ->  ok<TAB>ring:slot<TAB>milliseconds  or  error<TAB>message (shared memory frames, see FrameRing.h)
+//  close<TAB>ring  ->  ok, the service unmaps the ring
+//  ping  ->  ok
+//  shutdown  ->  ok, the service exits after the reply
+
+#include <string>
+#include <vector>
+#include <sstream>
+
+const char* const DEFAULT_SOCKET_PATH = "/tmp/histogram_equalisation.sock";
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+
+//Fills in the socket address, false if the path does not fit into sun_path
+inline bool GetSocketAddress(const std::string& path, sockaddr_un& address) {
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.empty() || path.size() >= sizeof(address.sun_path))
+		return false;
+	strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+	return true;
+}
+
+//Listening socket for the service, a socket file left behind by a service that did not shut down cleanly is replaced.
+//Returns -1 on failure (errno is set).
+inline int ListenUnixSocket(const std::string& path) {
+	sockaddr_un address;
+	if (!GetSocketAddress(path, address)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	unlink(path.c_str());
+	if (bind(fd, (sockaddr*)&address, sizeof(address)) < 0 || listen(fd, 16) < 0) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+	return fd;
+}
+
+//Returns -1 on failure (errno is set), e.g. ECONNREFUSED or ENOENT when the service is not running
+inline int ConnectUnixSocket(const std::string& path) {
+	sockaddr_un address;
+	if (!GetSocketAddress(path, address)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	if (connect(fd, (sockaddr*)&address, sizeof(address)) < 0) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+	return fd;
+}
+
+//Sends a whole line (the newline is added here)
+inline bool SendLine(int fd, const std::string& line) {
+	std::string data = line + "\n";
+	size_t sent = 0;
+	while (sent < data.size()) {
+		ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		sent += n;
+	}
+	return true;
+}
+
+//Next line from the socket without the newline, buffer keeps whatever was received past it for the next call.
+//False once the other side has closed the connection.
+inline bool ReceiveLine(int fd, std::string& buffer, std::string& line) {
+	size_t end;
+	while ((end = buffer.find('\n')) == std::string::npos) {
+		char data[4096];
+		ssize_t n = recv(fd, data, sizeof(data), 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		buffer.append(data, n);
+	}
+	line = buffer.substr(0, end);
+	buffer.erase(0, end + 1);
+	if (!line.empty() && line.back() == '\r')
+		line.pop_back();
+	return true;
+}
+#endif
+
+inline std::vector<std::string> SplitFields(const std::string& line, char separator = '\t') {
+	std::vector<std::string> fields;
+	std::stringstream sstream(line);
+	std::string field;
+	while (std::getline(sstream, field, separator))
+		fields.push_back(field);
+	return fields;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <chrono>
+#include "Utils.h"
+
+//Where the wall time of one frame goes: host stages (file decode, setup, waiting on the device) timed with the steady clock
+//and device commands (writes, kernels, reads) from their profiling events. The queue has to have CL_QUEUE_PROFILING_ENABLE.
+struct StageTiming {
+	string name;
+	bool device = false; //device command (profiling event) or host code (steady clock)
+	double start_ms = 0; //host stages: from the start of the frame
+	double wait_us = 0; //device commands: queued to start, i.e. time spent behind other commands or in the driver
+	double time_us = 0; //host: wall time, device: start to end of the command
+};
+
+struct FrameReport {
+	string frame;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	vector<StageTiming> stages;
+};
+
+//Host stage from start until now
+inline void AddHostStage(FrameReport& report, const string& name, chrono::steady_clock::time_point start) {
+	auto end = chrono::steady_clock::now();
+	StageTiming stage;
+	stage.name = name;
+	stage.start_ms = chrono::duration<double, milli>(start - report.start).count();
+	stage.time_us = chrono::duration<double, micro>(end - start).count();
+	report.stages.push_back(stage);
+}
+
+//Device command, has to be complete. Empty events (commands that were not needed, e.g. the upload with zero copy) are left out.
+inline void AddDeviceStage(FrameReport& report, const string& name, const cl::Event& event) {
+	if (event() == NULL)
+		return;
+	StageTiming stage;
+	stage.name = name;
+	stage.device = true;
+	stage.wait_us = (event.getProfilingInfo<CL_PROFILING_COMMAND_START>() - event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>()) / 1000.0;
+	stage.time_us = (event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>()) / 1000.0;
+	report.stages.push_back(stage);
+}
+
+inline string FormatFrameReport(const FrameReport& report) {
+	stringstream sstream;
+	sstream << "Timing of " << report.frame << ":" << endl;
+	sstream << "  stage                          clock   start [ms]   wait [us]   time [us]" << endl;
+	double host_total = 0;
+	for (const StageTiming& stage : report.stages) {
+		char line[160];
+		if (stage.device)
+			snprintf(line, sizeof(line), "  %-30s device  %10s  %10.1f  %10.1f", stage.name.c_str(), "", stage.wait_us, stage.time_us);
+		else
+			snprintf(line, sizeof(line), "  %-30s host    %10.2f  %10s  %10.1f", stage.name.c_str(), stage.start_ms, "", stage.time_us);
+		sstream << line << endl;
+		if (!stage.device)
+			host_total += stage.time_us;
+	}
+	sstream << "  host stages total: " << host_total / 1000.0 << " ms" << endl;
+	return sstream.str();
+}
+
+//Quotes and backslashes only, file and device names are the only free text
+inline string JsonString(const string& text) {
+	string quoted = "\"";
+	for (char c : text) {
+		if (c == '"' || c == '\\')
+			quoted += '\\';
+		quoted += c;
+	}
+	return quoted + "\"";
+}
+
+//One object per frame with its list of stages
+inline void WriteFrameReportsJson(ostream& out, const vector<FrameReport>& reports) {
+	out << "[";
+	for (size_t i = 0; i < reports.size(); i++) {
+		out << (i == 0 ? "\n" : ",\n") << "  { \"frame\": " << JsonString(reports[i].frame) << ", \"stages\": [";
+		const vector<StageTiming>& stages = reports[i].stages;
+		for (size_t j = 0; j < stages.size(); j++) {
+			out << (j == 0 ? "\n" : ",\n") << "    { \"name\": " << JsonString(stages[j].name) << ", \"clock\": \"" << (stages[j].device ? "device" : "host") << "\"";
+			if (stages[j].device)
+				out << ", \"wait_us\": " << stages[j].wait_us;
+			else
+				out << ", \"start_ms\": " << stages[j].start_ms;
+			out << ", \"time_us\": " << stages[j].time_us << " }";
+		}
+		out << "\n  ] }";
+	}
+	out << "\n]\n";
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <map>
+#include <iomanip>
+#include "Utils.h"
+#include "Timing.h"
+
+//Timeline of every command enqueued on the traced queues (writes, fills, kernels, reads, maps), written as a Chrome trace event file
+//that chrome://tracing or ui.perfetto.dev opens. Every device is a process and every queue a thread of it, so the overlap of uploads,
+//kernels and downloads across images in flight or across devices can be seen at a glance. The queues need CL_QUEUE_PROFILING_ENABLE.
+//Record is thread safe (the batch mode runs a host thread per device), the events are kept and only read in WriteChromeTrace,
+//i.e. after the queues have finished.
+class CommandTrace {
+public:
+	//New track for a queue, the device timestamps of the queue are put on the host clock with a marker: the queued time of a command
+	//is taken when it is enqueued, so the host time around clEnqueueMarker gives the offset of the device clock.
+	int AddTrack(const string& device, const string& queue_name, cl::CommandQueue& queue) {
+		Track track;
+		track.device = device;
+		track.queue = queue_name;
+		try {
+			cl::Event marker;
+			auto before = chrono::steady_clock::now();
+			queue.enqueueMarkerWithWaitList(NULL, &marker);
+			auto after = chrono::steady_clock::now();
+			marker.wait();
+			double host_ns = chrono::duration<double, nano>(before - start_).count() + chrono::duration<double, nano>(after - before).count() / 2;
+			track.offset_ns = host_ns - (double)marker.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+			track.calibrated = true;
+		}
+		catch (const cl::Error&) {
+			//no profiling info for markers on some runtimes, the offset then comes from the recorded commands
+		}
+
+		lock_guard<mutex> lock(mutex_);
+		tracks_.push_back(track);
+		return (int)tracks_.size() - 1;
+	}
+
+	//Call right after the command was enqueued, without a marker the host time now is the best guess for when it was queued.
+	//Empty events (commands that were skipped) are left out.
+	void Record(int track, const string& name, const cl::Event& event) {
+		if (event() == NULL)
+			return;
+		Command command;
+		command.track = track;
+		command.name = name;
+		command.event = event;
+		command.recorded_ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start_).count();
+		lock_guard<mutex> lock(mutex_);
+		commands_.push_back(command);
+	}
+
+	//{ "traceEvents": [...] } with a complete ("X") event per command and the process and thread names of the tracks, times in us
+	//from the creation of the trace. The wait from queued to start goes into the args.
+	void WriteChromeTrace(ostream& out) {
+		lock_guard<mutex> lock(mutex_);
+
+		//device clocks of uncalibrated tracks: the command queued closest after it was recorded gives the smallest offset
+		vector<double> offsets(tracks_.size(), 0);
+		vector<bool> has_offset(tracks_.size(), false);
+		for (size_t t = 0; t < tracks_.size(); t++) {
+			offsets[t] = tracks_[t].offset_ns;
+			has_offset[t] = tracks_[t].calibrated;
+		}
+		for (const Command& command : commands_) {
+			if (tracks_[command.track].calibrated)
+				continue;
+			double offset = command.recorded_ns - (double)command.event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+			if (!has_offset[command.track] || offset < offsets[command.track]) {
+				offsets[command.track] = offset;
+				has_offset[command.track] = true;
+			}
+		}
+
+		//one pid per device name, one tid per track
+		map<string, int> pids;
+		for (const Track& track : tracks_) {
+			if (pids.count(track.device) == 0)
+				pids[track.device] = (int)pids.size() + 1;
+		}
+
+		out << "{ \"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+		bool first = true;
+		auto separator = [&]() { out << (first ? "\n" : ",\n"); first = false; };
+		for (const auto& pid : pids) {
+			separator();
+			out << "  { \"ph\": \"M\", \"name\": \"process_name\", \"pid\": " << pid.second << ", \"args\": { \"name\": " << JsonString(pid.first) << " } }";
+		}
+		for (size_t t = 0; t < tracks_.size(); t++) {
+			separator();
+			out << "  { \"ph\": \"M\", \"name\": \"thread_name\", \"pid\": " << pids[tracks_[t].device] << ", \"tid\": " << t + 1
+				<< ", \"args\": { \"name\": " << JsonString(tracks_[t].queue) << " } }";
+		}
+		for (const Command& command : commands_) {
+			double queued = (double)command.event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+			double start = (double)command.event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+			double end = (double)command.event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+			separator();
+			out << "  { \"ph\": \"X\", \"name\": " << JsonString(command.name) << ", \"pid\": " << pids[tracks_[command.track].device] << ", \"tid\": " << command.track + 1
+				<< ", \"ts\": " << fixed << setprecision(3) << (start + offsets[command.track]) / 1000.0 << ", \"dur\": " << (end - start) / 1000.0
+				<< ", \"args\": { \"wait_us\": " << (start - queued) / 1000.0 << " } }" << defaultfloat;
+		}
+		out << "\n] }\n";
+	}
+
+private:
+	struct Track {
+		string device, queue;
+		double offset_ns = 0; //device clock -> ns since start_
+		bool calibrated = false;
+	};
+	struct Command {
+		int track = 0;
+		string name;
+		cl::Event event;
+		double recorded_ns = 0;
+	};
+
+	chrono::steady_clock::time_point start_ = chrono::steady_clock::now();
+	vector<Track> tracks_;
+	vector<Command> commands_;
+	mutex mutex_;
+};
+
+//Writes the trace to a file, the file name comes from --trace
+inline bool WriteChromeTraceFile(CommandTrace& trace, const string& file_name) {
+	ofstream file(file_name);
+	if (!file.is_open()) {
+		std::cerr << "Unable to write " << file_name << std::endl;
+		return false;
+	}
+	trace.WriteChromeTrace(file);
+	std::cout << "Command trace written to " << file_name << " (open it in chrome://tracing or ui.perfetto.dev)" << std::endl;
+	return true;
+}
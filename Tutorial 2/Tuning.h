@@ -0,0 +1,143 @@
+#pragma once
+
+#include <map>
+#include <functional>
+#include <algorithm>
+#include <cctype>
+#include "Utils.h"
+
+//Launch settings for one kernel, picked by Autotune and kept per device in a tuning file
+struct LaunchConfig {
+	size_t work_group_size = 0;
+	cl_uint pixels_per_item = 1;
+	cl_uint replicas = 1; //copies of the local histogram (histogram_local only)
+};
+
+//All tuned settings of one device, keyed by GetTuningKey
+struct TuningTable {
+	string file_name;
+	map<string, LaunchConfig> configs;
+	bool force = false; //benchmark again even when there is already an entry
+	bool changed = false; //new entries that still have to be saved
+};
+
+//Candidate values tried by Autotune, every combination is benchmarked
+struct TuningSpace {
+	vector<size_t> work_group_sizes;
+	vector<cl_uint> pixels_per_item;
+	vector<cl_uint> replicas;
+};
+
+//One tuning file per device and driver version, since a driver update can move the optimum as much as a new device
+inline string GetTuningFileName(const cl::Device& device) {
+	string name = device.getInfo<CL_DEVICE_NAME>() + "_" + device.getInfo<CL_DRIVER_VERSION>();
+	//a sub-device (device fission) only has part of the compute units, so it is tuned separately from the whole device
+	if (device.getInfo<CL_DEVICE_PARENT_DEVICE>()() != nullptr)
+		name += "_" + to_string(device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>()) + "cu";
+	for (char& c : name) {
+		if (!isalnum((unsigned char)c))
+			c = '_';
+	}
+	return "tuning_" + name + ".txt";
+}
+
+//The best settings depend on the kernel, the pixel type and the number of bins
+inline string GetTuningKey(const string& kernel_name, int bit_depth, int nr_bins) {
+	stringstream sstream;
+	sstream << kernel_name << " " << bit_depth << " " << nr_bins;
+	return sstream.str();
+}
+
+//Each line is "kernel bit_depth nr_bins work_group_size pixels_per_item replicas", lines starting with # are comments.
+//A missing file is not an error, it just means nothing has been tuned on this device yet.
+inline bool LoadTuning(TuningTable& tuning) {
+	ifstream file(tuning.file_name);
+	if (!file.is_open())
+		return false;
+
+	string line;
+	while (getline(file, line)) {
+		if (line.empty() || line[0] == '#')
+			continue;
+		stringstream sstream(line);
+		string kernel_name;
+		int bit_depth, nr_bins;
+		LaunchConfig config;
+		if (sstream >> kernel_name >> bit_depth >> nr_bins >> config.work_group_size >> config.pixels_per_item >> config.replicas)
+			tuning.configs[GetTuningKey(kernel_name, bit_depth, nr_bins)] = config;
+	}
+	return true;
+}
+
+inline void SaveTuning(TuningTable& tuning) {
+	ofstream file(tuning.file_name);
+	if (!file.is_open()) {
+		cerr << "Unable to write tuning file " << tuning.file_name << endl;
+		return;
+	}
+	file << "#kernel bit_depth nr_bins work_group_size pixels_per_item replicas\n";
+	for (const auto& entry : tuning.configs) {
+		const LaunchConfig& config = entry.second;
+		file << entry.first << " " << config.work_group_size << " " << config.pixels_per_item << " " << config.replicas << "\n";
+	}
+	tuning.changed = false;
+}
+
+//Tuned settings if the table has them, otherwise the given default (e.g. where there is no time to tune)
+inline LaunchConfig FindLaunchConfig(const TuningTable& tuning, const string& key, const LaunchConfig& default_config) {
+	auto entry = tuning.configs.find(key);
+	return entry != tuning.configs.end() ? entry->second : default_config;
+}
+
+//Powers of two from 16 up to the limit, plus the limit itself if it is not a power of two
+inline vector<size_t> GetWorkGroupCandidates(size_t max_work_group_size) {
+	vector<size_t> sizes;
+	for (size_t size = 16; size <= max_work_group_size; size *= 2)
+		sizes.push_back(size);
+	if (sizes.empty() || sizes.back() != max_work_group_size)
+		sizes.push_back(max_work_group_size);
+	return sizes;
+}
+
+//Benchmarks every combination in the search space with run() and returns the fastest one.
+//run() has to enqueue the kernel with the given settings and return its (profiling) event.
+//Each candidate gets one warm up run and the best of the timed repeats is kept, settings the device rejects are skipped.
+inline LaunchConfig Autotune(const TuningSpace& space, const std::function<cl::Event(const LaunchConfig&)>& run, int repeats = 3) {
+	LaunchConfig best;
+	bool have_best = false; //a candidate can measure 0 ns with coarse profiling timers, so 0 cannot mean "none yet"
+	cl_ulong best_time = 0;
+
+	for (size_t work_group_size : space.work_group_sizes) {
+		for (cl_uint pixels_per_item : space.pixels_per_item) {
+			for (cl_uint replicas : space.replicas) {
+				LaunchConfig config;
+				config.work_group_size = work_group_size;
+				config.pixels_per_item = pixels_per_item;
+				config.replicas = replicas;
+
+				try {
+					run(config).wait();
+					cl_ulong time = 0;
+					for (int i = 0; i < repeats; i++) {
+						cl::Event event = run(config);
+						event.wait();
+						cl_ulong t = event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+						time = (i == 0) ? t : min(time, t);
+					}
+					if (!have_best || time < best_time) {
+						best = config;
+						best_time = time;
+						have_best = true;
+					}
+				}
+				catch (const cl::Error&) {
+					//e.g. CL_INVALID_WORK_GROUP_SIZE or CL_OUT_OF_RESOURCES, just not a valid candidate on this device
+				}
+			}
+		}
+	}
+
+	if (!have_best)
+		throw cl::Error(CL_INVALID_VALUE, "Autotune: no candidate could be launched");
+	return best;
+}
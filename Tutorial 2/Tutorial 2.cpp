@@ -3,6 +3,17 @@
 #include <vector>
 #include "Utils.h"
 #include "CImg.h"
+#include "Tuning.h"
+#include "Dispatch.h"
+#include "Pipeline.h"
+#include "MultiDevice.h"
+#include "ImageIO.h"
+#include "Batch.h"
+#include "Service.h"
+#include "Timing.h"
+#include "Trace.h"
+#include "Validate.h"
+#include "HistogramEqualizer.h"
 
 using namespace cimg_library;
 
@@ -12,230 +23,360 @@ void print_help() {
 	std::cerr << "  -p : select platform " << std::endl;
 	std::cerr << "  -d : select device" << std::endl;
 	std::cerr << "  -l : list all platforms and devices" << std::endl;
-	std::cerr << "  -f : input image file (default: test.ppm)" << std::endl;
+	std::cerr << "  -f : input image file (default: test.ppm), give it more than once to equalise a batch" << std::endl;
+	std::cerr << "  -t : re-run the launch settings autotuner for this device" << std::endl;
+	std::cerr << "  -m : split the image over every device of the selected platform" << std::endl;
+	std::cerr << "  -M : split the image over every device of every platform" << std::endl;
+	std::cerr << "  -n : partition the selected device by NUMA node and run one pipeline per node (batch mode)" << std::endl;
+	std::cerr << "  -q : images in flight per device in batch mode, on an out-of-order queue (default: 4)" << std::endl;
+	std::cerr << "  --report file : write the per-stage timing of the frame as JSON" << std::endl;
+	std::cerr << "  --trace file : write every command of the device queues as a Chrome trace (chrome://tracing, ui.perfetto.dev)" << std::endl;
+	std::cerr << "  --validate [kernel] : check every kernel variant (or just the given one, or library) against the scalar reference" << std::endl;
+	std::cerr << "  --explain : print the device capabilities and why each kernel was picked" << std::endl;
+	std::cerr << "  -b : number of bins (asked for if not given)" << std::endl;
+	std::cerr << "  --serve [socket] : run as a service, equalising the images sent by equalise_client (default socket: /tmp/histogram_equalisation.sock)" << std::endl;
 	std::cerr << "  -h : print this message" << std::endl;
 }
 
+//Part 4 - device operations
+//Equalises an 8-bit (unsigned char) or 16-bit (unsigned short) image on one device with the HistogramEqualizer library,
+//every channel gets its own histogram. The equalizer builds the program and keeps the LUT on the device, the kernels are tuned
+//here first (anything missing from the device's tuning file, everything with retune) and the file is updated.
+template <typename T>
+CImg<T> Equalise(const cl::Context& context, const CImg<T>& image_input, int nr_bins, int bit_depth, bool retune, bool explain, FrameReport& report, CommandTrace* trace) {
+	auto start = chrono::steady_clock::now();
+	EqualizerFormat format;
+	format.width = image_input.width();
+	format.height = (size_t)image_input.height() * image_input.depth();
+	format.channels = image_input.spectrum();
+	format.bit_depth = bit_depth;
+	format.nr_bins = nr_bins;
+	EqualizerOptions options;
+	options.tuning_file = GetTuningFileName(context.getInfo<CL_CONTEXT_DEVICES>()[0]);
+	options.save_tuning = true;
+	HistogramEqualizer<T> equalizer(context, format, options);
+	AddHostStage(report, "setup (queue, build, buffers)", start);
+	int track = trace ? trace->AddTrack(equalizer.caps().name, "queue", equalizer.queue()) : 0;
+	if (explain)
+		std::cout << ExplainPlan(equalizer.caps(), equalizer.plan());
+
+	start = chrono::steady_clock::now();
+	equalizer.tune({ image_input.data(), image_input.size() }, retune);
+	AddHostStage(report, "tuning", start);
+	std::cout << "Tuning file: " << equalizer.tuning().file_name << std::endl;
+
+	const int channels = format.channels;
+	CImg<T> image_output(image_input.width(), image_input.height(), image_input.depth(), channels);
+
+	//4.3 Histogram, scan, LUT and the output image in one go, the cumulative histogram is read back on the way for printing
+	start = chrono::steady_clock::now();
+	std::vector<unsigned int> cumulative_histogram((size_t)nr_bins * channels);
+	equalizer.equalize({ image_input.data(), image_input.size() }, { image_output.data(), image_output.size() }, cumulative_histogram);
+	AddHostStage(report, "equalise", start);
+	//every command of the call, the ones it did not need (e.g. the upload of wrapped memory) have no event and are left out
+	const EqualizerEvents& events = equalizer.events();
+	const vector<pair<string, const cl::Event*>> stages = {
+		{ "upload", &events.upload },
+		{ "histogram fill", &events.histogram_fill },
+		{ equalizer.plan().histogram, &events.histogram },
+		{ equalizer.plan().scan, &events.scan },
+		{ "cdf readback", &events.cdf_download },
+		{ "lut_reciprocal", &events.lut_reciprocal },
+		{ "lut_build_reciprocal", &events.lut_build },
+		{ "copy to image", &events.image_copy },
+		{ equalizer.plan().lut, &events.lut },
+		{ "map output", &events.output_map },
+		{ "readback", &events.download } };
+	for (const auto& stage : stages) {
+		AddDeviceStage(report, "equalise: " + stage.first, *stage.second);
+		if (trace)
+			trace->Record(track, "equalise: " + stage.first, *stage.second);
+	}
+
+	//Printing all the
+	const KernelPlan& plan = equalizer.plan();
+	const LaunchConfig& histogram_config = equalizer.histogram_config();
+	std::cout << "Histogram kernel: " << plan.histogram << ", scan kernel: " << plan.scan << ", LUT kernel: " << plan.lut << std::endl;
+	std::cout << "Local work size: " << histogram_config.work_group_size << std::endl;
+	std::cout << "Pixels per work item: " << histogram_config.pixels_per_item << std::endl;
+	std::cout << "Histogram replicas: " << histogram_config.replicas << std::endl;
+	std::cout << "Maximum work group size: " << equalizer.caps().max_work_group_size << std::endl;
+	std::cout << "Image size: " << image_input.size() << std::endl;
+	std::cout << "Bit depth: " << bit_depth << std::endl;
+	std::cout << "Number bins: " << nr_bins << std::endl;
+
+	//Output the raw cumulative histogram (pixel counts) of the first channel, the LUT is built from it on the device (see below for .txt output of every channel)
+	for (int i = 0; i < nr_bins; ++i) {
+		std::cout << i << " " << cumulative_histogram[i] << std::endl;
+	}
+
+	//Output kernel info
+	std::cout << "Kernel execution time [ns]:" <<
+		events.histogram.getProfilingInfo<CL_PROFILING_COMMAND_END>() - events.histogram.getProfilingInfo<CL_PROFILING_COMMAND_START>() << std::endl;
+
+	std::cout << GetFullProfilingInfo(events.histogram, ProfilingResolution::PROF_US)
+		<< std::endl;
+
+	//Checking histogram values
+	std::ofstream histogram_file("histogram.txt");
+	if (histogram_file.is_open()) {
+		const char* channel_names[] = { "Red", "Green", "Blue" };
+		for (int c = 0; c < channels; ++c) {
+			histogram_file << (channels == 3 ? channel_names[c] : "Greyscale") << " Histogram:\n";
+			for (int i = 0; i < nr_bins; ++i) {
+				histogram_file << i << ": " << cumulative_histogram[(size_t)c * nr_bins + i] << "\n";
+			}
+		}
+		histogram_file.close();
+	}
+	else {
+		std::cerr << "Unable to open histogram file" << std::endl;
+	}
+
+	return image_output;
+}
+
+//Prints the stage timing and writes it as JSON if --report was given
+void PrintFrameReport(const FrameReport& report, const string& file_name) {
+	std::cout << FormatFrameReport(report);
+	if (!file_name.empty()) {
+		std::ofstream file(file_name);
+		if (file.is_open())
+			WriteFrameReportsJson(file, { report });
+		else
+			std::cerr << "Unable to write " << file_name << std::endl;
+	}
+}
+
+//Shows the input and the equalised image until one of them is closed
+template <typename T>
+void Display(const CImg<T>& image_input, const CImg<T>& image_output) {
+	CImgDisplay disp_input(image_input, "input image");
+	CImgDisplay disp_output(image_output, "output image");
+
+	while (!disp_input.is_closed() && !disp_output.is_closed()
+		&& !disp_input.is_keyESC() && !disp_output.is_keyESC()) {
+		disp_input.wait(1);
+		disp_output.wait(1);
+	}
+}
+
 int main(int argc, char** argv) {
 	//Part 1 - handle command line options such as device selection, verbosity, etc.
 	int platform_id = 0;
 	int device_id = 0;
+	bool retune = false;
+	bool explain = false;
+	bool multi_device = false;
+	bool all_platforms = false;
+	bool numa = false;
+	int images_in_flight = 4;
+	vector<string> batch_filenames;
 
-	int image_choice = 1;
-	std::cout << "choose file:\n1 = 8-bit mono\n2 = 16-bit mono\n3 = 8-bit colour\n(enter 1, 2 or 3): ";
-	std::cin >> image_choice;
 	string image_filename = "";
-	//I know this part isnt graded but it looks pretty 
-	//If the image names are different have fun changing them
-	switch (image_choice) {
-	case 1:
-		image_filename = "test.pgm"; //8bit mono 209 - 543 (note some values will cause race conditions)
-		cout << (image_filename) << endl;
-		break;
-	case 2:
-		image_filename = "mdr16-gs.pgm"; //16 bit mono
-		cout << (image_filename) << endl; 
-		break;
-	case 3:
-		image_filename = "test_large.ppm"; //8 bit colour this doesn't work
-		cout << (image_filename) << endl;
-		break;
-	default:
-		image_filename = "test.pgm";
-		cout << (image_filename) << endl; 
-		break;
-	}
+	int nr_bins = 0; //asked for if not given
+	bool serve = false;
+	string socket_path;
+	string report_filename;
+	string trace_filename;
+	bool validate = false;
+	string validate_kernel;
 
 	for (int i = 1; i < argc; i++) {
 		if ((strcmp(argv[i], "-p") == 0) && (i < (argc - 1))) { platform_id = atoi(argv[++i]); }
 		else if ((strcmp(argv[i], "-d") == 0) && (i < (argc - 1))) { device_id = atoi(argv[++i]); }
 		else if (strcmp(argv[i], "-l") == 0) { std::cout << ListPlatformsDevices() << std::endl; }
-		else if ((strcmp(argv[i], "-f") == 0) && (i < (argc - 1))) { image_filename = argv[++i]; }
+		else if ((strcmp(argv[i], "-f") == 0) && (i < (argc - 1))) { image_filename = argv[++i]; batch_filenames.push_back(image_filename); }
+		else if (strcmp(argv[i], "-t") == 0) { retune = true; }
+		else if (strcmp(argv[i], "--explain") == 0) { explain = true; }
+		else if (strcmp(argv[i], "-m") == 0) { multi_device = true; }
+		else if (strcmp(argv[i], "-M") == 0) { all_platforms = true; }
+		else if (strcmp(argv[i], "-n") == 0) { numa = true; }
+		else if ((strcmp(argv[i], "-q") == 0) && (i < (argc - 1))) { images_in_flight = max(1, atoi(argv[++i])); }
+		else if ((strcmp(argv[i], "-b") == 0) && (i < (argc - 1))) { nr_bins = atoi(argv[++i]); }
+		else if ((strcmp(argv[i], "--report") == 0) && (i < (argc - 1))) { report_filename = argv[++i]; }
+		else if ((strcmp(argv[i], "--trace") == 0) && (i < (argc - 1))) { trace_filename = argv[++i]; }
+		else if (strcmp(argv[i], "--validate") == 0) { validate = true; validate_kernel = (i < (argc - 1) && argv[i + 1][0] != '-') ? argv[++i] : ""; }
+		else if (strcmp(argv[i], "--serve") == 0) { serve = true; socket_path = (i < (argc - 1) && argv[i + 1][0] != '-') ? argv[++i] : DEFAULT_SOCKET_PATH; }
 		else if (strcmp(argv[i], "-h") == 0) { print_help(); return 0; }
 	}
 
+	//ask for the image unless -f gave one, the service gets its images from the clients
+	if (batch_filenames.empty() && !serve) {
+		int image_choice = 1;
+		std::cout << "choose file:\n1 = 8-bit mono\n2 = 16-bit mono\n3 = 8-bit colour\n(enter 1, 2 or 3): ";
+		std::cin >> image_choice;
+		//I know this part isnt graded but it looks pretty
+		//If the image names are different have fun changing them
+		switch (image_choice) {
+		case 1:
+			image_filename = "test.pgm"; //8bit mono
+			cout << (image_filename) << endl;
+			break;
+		case 2:
+			image_filename = "mdr16-gs.pgm"; //16 bit mono
+			cout << (image_filename) << endl;
+			break;
+		case 3:
+			image_filename = "test_large.ppm"; //8 bit colour
+			cout << (image_filename) << endl;
+			break;
+		default:
+			image_filename = "test.pgm";
+			cout << (image_filename) << endl;
+			break;
+		}
+	}
+
 	cimg::exception_mode(0);
 
 	//detect any potential exceptions
 	try {
-		//Dynamically set number of bins 
-		int nr_bins = 256; //Default Value
-		cout << "Enter No. Bins - ";
-		cin >> nr_bins; //Should probably have error handling but not graded so...
-
-		//To switch between 8bitGS, 16bitGS, and 8bit colour you will need to uncomment and comment several things.
-		//or you could just give me the marks just for 8bit if you can't be bothered.
-	
-			
-		CImg<unsigned char> image_input(image_filename.c_str()); //8bit
-		//CImg<unsigned short> image_input(image_filename.c_str()); //16bit
-
-		CImg<unsigned char> image_output(image_filename.c_str()); //8bit
-		//CImg<unsigned short> image_output(image_filename.c_str()); //16bit
-
-
-		CImgDisplay disp_input(image_input, "input image");
-		//Part 3 - host operations
-		//3.1 Select computing devices
-		cl::Context context = GetContext(platform_id, device_id);
-		//display the selected device
-		std::cout << "Running on " << GetPlatformName(platform_id) << ", " << GetDeviceName(platform_id, device_id) << std::endl;
-
-		//create a queue to which we will push commands for the device
-		cl::CommandQueue queue(context, CL_QUEUE_PROFILING_ENABLE);
-
-		//3.2 Load & build the device code
-		cl::Program::Sources sources;
-		AddSources(sources, "kernels.cl");
-		cl::Program program(context, sources);
-
-		//build and debug the kernel code
-		try {
-			program.build();
+		//timing of the single device path, the prompt for the bins shows up as a gap between the stages
+		FrameReport report;
+		report.frame = image_filename;
+		//command timeline of the batch, multi-device or single device run
+		CommandTrace command_trace;
+		CommandTrace* trace = trace_filename.empty() ? NULL : &command_trace;
+
+		//8-bit and 16-bit images are told apart by the max value in the header, the kernels and the LUT work for any bit depth
+		auto start = chrono::steady_clock::now();
+		int max_pixel_value = serve ? 255 : GetPnmMaxValue(image_filename);
+		AddHostStage(report, "read header", start);
+		int bit_depth = GetBitDepth(max_pixel_value);
+		int levels = 1 << bit_depth;
+
+		//Dynamically set number of bins
+		//(the service checks the bins of every job against the bit depth of its image)
+		if (nr_bins == 0 && serve) {
+			nr_bins = 256; //Default Value
 		}
-		catch (const cl::Error& err) {
-			std::cout << "Build Status: " << program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(context.getInfo<CL_CONTEXT_DEVICES>()[0]) << std::endl;
-			std::cout << "Build Options:\t" << program.getBuildInfo<CL_PROGRAM_BUILD_OPTIONS>(context.getInfo<CL_CONTEXT_DEVICES>()[0]) << std::endl;
-			std::cout << "Build Log:\t " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(context.getInfo<CL_CONTEXT_DEVICES>()[0]) << std::endl;
-			throw err;
+		else if (nr_bins == 0) {
+			nr_bins = 256;
+			cout << "Enter No. Bins - ";
+			cin >> nr_bins;
 		}
-
-		//Part 4 - device operations
-		//Getting max group size info
-		std::vector<cl::Device> devices;
-		context.getInfo(CL_CONTEXT_DEVICES, &devices);  
-		cl_device_id device_id_cl = devices[device_id]();
-		size_t max_work_group_size;
-		clGetDeviceInfo(device_id_cl, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &max_work_group_size, NULL); 
-		size_t local_work_size = nr_bins < max_work_group_size ? nr_bins : max_work_group_size; //cheeky ternary operator, just wanted to show off c++ skills
-
-		//Printing all the 
-		std::cout << "Local work size: " << local_work_size << std::endl;
-		std::cout << "Maximum work group size: " << max_work_group_size << std::endl;
-		std::cout << "Image size: " << image_input.size() << std::endl;
-		std::cout << "Number bins: " << nr_bins << std::endl;
-
-		//device - buffers
-		//greyscale
-		cl::Buffer dev_image_input(context, CL_MEM_READ_ONLY, image_input.size()); //8bit
-		//cl::Buffer dev_image_input(context, CL_MEM_READ_ONLY, image_input.size() * sizeof(unsigned short)); //16bit
-
-		cl::Buffer dev_cumulative_histogram(context, CL_MEM_WRITE_ONLY, sizeof(int) * nr_bins); //both 8-bit and 16-bit
-		//cl::Buffer dev_cumulative_histogram(context, CL_MEM_WRITE_ONLY, sizeof(int) * 3 * nr_bins); //COLOUR
-
-		//greyscale
-
-	
-		//Copy images to device memory
-		queue.enqueueWriteBuffer(dev_image_input, CL_TRUE, 0, image_input.size() * sizeof(unsigned char), &image_input.data()[0]); //8bit 
-		//queue.enqueueWriteBuffer(dev_image_input, CL_TRUE, 0, image_input.size() * sizeof(unsigned short), &image_input.data()[0]); //16bit
-
-		//4.2 Setup and execute the kernel (i.e. device code)
-		cl::Kernel kernel = cl::Kernel(program, "cumulative_histogram"); //change kernel (all have same number of params)
-		kernel.setArg(0, dev_image_input);
-		kernel.setArg(1, dev_cumulative_histogram); //image_output
-		kernel.setArg(2, nr_bins); //bin number  //Change to kernel 4 for colour
-		cl::Event prof_event; //Timing kernel execution
-
-		//queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(max_work_group_size), cl::NDRange(local_work_size), NULL, &prof_event); //if you want to only use max work gorup (for some reason)
-		queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(nr_bins), cl::NDRange(local_work_size), NULL, &prof_event); //8-bit and 16-bit mono
-		//queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(image_input.size() / 3), cl::NullRange, NULL, &prof_event); //Colour
-
-
-		//4.3 Copy the result from device to host
-		cl::Event kernel_event;
-		std::vector<unsigned int> cumulative_histogram(nr_bins, 0); //greyscale
-		//std::vector<unsigned int> cumulative_histogram(3 * nr_bins, 0); //COLOUR
-
-		queue.enqueueReadBuffer(dev_cumulative_histogram, CL_TRUE, 0, sizeof(int) * nr_bins, cumulative_histogram.data(), NULL, &kernel_event); //8bit and 16bit mono
-		//queue.enqueueReadBuffer(dev_cumulative_histogram, CL_TRUE, 0, sizeof(unsigned int) * 3 * nr_bins, cumulative_histogram.data(), NULL, &kernel_event); //colour
-
-		vector<unsigned char> output_buffer(image_input.size()); //holds our look up table data
-		//COLOUR
-	
-		//COLOUR
-
-
-		//Greyscale
-		unsigned int max_value = cumulative_histogram[nr_bins - 1]; // Get the maximum value in the cumulative histogram 
-		// Scale and normalize the cumulative histogram
-		for (int i = 0; i < nr_bins; ++i) {					
-			cumulative_histogram[i] = static_cast<unsigned short>(cumulative_histogram[i] * 255 / max_value); //change this to 65535 for 16bit
+		if (!serve && (nr_bins < 1 || nr_bins > levels)) {
+			nr_bins = nr_bins < 1 ? 1 : levels;
+			cout << "Number of bins has to be between 1 and " << levels << ", using " << nr_bins << endl;
 		}
-	
-		////LOOK UP TABLE!
-		for (int i = 0; i < image_input.width(); ++i) { //for each pixel..
-			for (int j = 0; j < image_input.height(); ++j) {
-				int pixel_value = image_input(i, j); //original pixel intensity at co-ord i,j
-				int new_pixel_value = cumulative_histogram[pixel_value]; //actual assignment
-				output_buffer[i + j * image_input.width()] = static_cast<unsigned int>(new_pixel_value);
+
+		//Contexts for the multi-device and batch modes: every device of the platform (or of every platform),
+		//one per NUMA node of the selected device or just the selected device
+		vector<cl::Context> contexts;
+		if (multi_device || all_platforms) {
+			vector<cl::Platform> platforms;
+			cl::Platform::get(&platforms);
+			for (int i = 0; i < (int)platforms.size(); i++) {
+				vector<cl::Device> devices;
+				platforms[i].getDevices((cl_device_type)CL_DEVICE_TYPE_ALL, &devices);
+				if ((all_platforms || i == platform_id) && !devices.empty())
+					contexts.push_back(GetPlatformContext(i));
 			}
 		}
-		//Greyscale
-		
-
-		//Alternate way to do the look up table, gives same result
-		// Will need to change output_buffer.data() to image_output.data() in output_image()
-		//std::vector<int>lut(nr_bins);
-		//for (int i = 0; i < nr_bins; ++i) 
-		//	lut[i] = cumulative_histogram[i];
-		//cimg_forXY(image_input, x, y) {
-		//	int original = image_input(x, y);
-		//	int map = lut[original];
-		//	image_output(x, y) = map;
-		//}
-
-
-		//Output the normalized and scaled cumulative histogram (see below for .txt output alternative)
-		for (int i = 0; i < nr_bins; ++i) {
-			std::cout << i << " " << cumulative_histogram[i] << std::endl;
+		else if (numa) {
+			contexts = GetNumaContexts(platform_id, device_id);
+		}
+		else if (batch_filenames.size() > 1 || serve) {
+			contexts.push_back(GetContext(platform_id, device_id));
 		}
 
+		//Service mode, keeps the contexts, programs and buffers warm and takes jobs over a Unix domain socket (see Socket.h)
+		if (serve) {
+			EqualiseService service;
+			service.contexts = contexts;
+			service.nr_bins = nr_bins;
+			return RunService(service, socket_path) ? 0 : 1;
+		}
 
-		// Display the back-projected output image
-		CImg<unsigned char> output_image(output_buffer.data(), image_input.width(), image_input.height(), image_input.depth(), image_input.spectrum()); //8bit
-		//CImg<unsigned short> output_image(output_buffer.data(), image_input.width(), image_input.height(), image_input.depth(), image_input.spectrum()); //16bit
-		CImgDisplay disp_output(output_image, "output image");
+		//Batch mode, every device (or NUMA node) runs its own pipeline and takes the next image when it is done
+		if (numa || batch_filenames.size() > 1) {
+			if (batch_filenames.empty())
+				batch_filenames.push_back(image_filename);
+			vector<DeviceWorker> workers = CreateWorkers(contexts, nr_bins, bit_depth, true);
+			std::cout << "Running a batch of " << batch_filenames.size() << " image(s) on " << workers.size() << " device(s)" << (numa ? " (NUMA nodes)" : "") << std::endl;
+			if (explain) {
+				for (const DeviceWorker& worker : workers) {
+					std::cout << ExplainPlan(worker.caps, worker.plan);
+					std::cout << "  queue: " << (worker.out_of_order ? "out-of-order" : "in-order (no out-of-order support)") << ", " << images_in_flight << " image(s) in flight" << std::endl;
+				}
+			}
 
-		//Output kernel info
-		std::cout << "Kernel execution time [ns]:" <<
-			prof_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() -prof_event.getProfilingInfo<CL_PROFILING_COMMAND_START>() << std::endl;
+			if (bit_depth > 8)
+				EqualiseBatch<unsigned short>(workers, batch_filenames, nr_bins, bit_depth, images_in_flight, trace);
+			else
+				EqualiseBatch<unsigned char>(workers, batch_filenames, nr_bins, bit_depth, images_in_flight, trace);
+			if (trace)
+				WriteChromeTraceFile(command_trace, trace_filename);
+			return 0;
+		}
 
-		std::cout << GetFullProfilingInfo(prof_event, ProfilingResolution::PROF_US)
-			<< std::endl;
+		//Multi-device mode, every device equalises a band of rows of the image
+		if (multi_device || all_platforms) {
+			vector<DeviceWorker> workers = CreateWorkers(contexts, nr_bins, bit_depth);
+			std::cout << "Running on " << workers.size() << " device(s)" << std::endl;
+			if (explain) {
+				for (const DeviceWorker& worker : workers)
+					std::cout << ExplainPlan(worker.caps, worker.plan);
+			}
 
-		//Checking histogram values 
-		std::ofstream histogram_file("histogram.txt");
-		if (histogram_file.is_open()) {
-			histogram_file << "Greyscale Histogram:\n";
-			for (int i = 0; i < nr_bins; ++i) {
-				histogram_file << i << ": " << output_buffer[i] << "\n";
+			if (bit_depth > 8) {
+				CImg<unsigned short> image_input = ReadImage<unsigned short>(image_filename, max_pixel_value);
+				CImg<unsigned short> image_output = EqualiseMultiDevice(workers, image_input, nr_bins, bit_depth, trace);
+				if (trace)
+					WriteChromeTraceFile(command_trace, trace_filename);
+				Display(image_input, image_output);
 			}
-			//histogram_file << "Red Histogram:\n";
-			//for (int i = 0; i < 256; ++i) {
-			//	histogram_file << i << ": " << histogram_r[i] << "\n";
-			//}
-			//histogram_file << "\nGreen Histogram:\n";
-			//for (int i = 0; i < 256; ++i) {
-			//	histogram_file << i << ": " << histogram_g[i] << "\n";
-			//}
-			//histogram_file << "\nBlue Histogram:\n";
-			//for (int i = 0; i < 256; ++i) {
-			//	histogram_file << i << ": " << histogram_b[i] << "\n";
-			//}
-			histogram_file.close();
-		}
-		else {
-			std::cerr << "Unable to open histogram file" << std::endl;
+			else {
+				CImg<unsigned char> image_input = ReadImage<unsigned char>(image_filename, max_pixel_value);
+				CImg<unsigned char> image_output = EqualiseMultiDevice(workers, image_input, nr_bins, bit_depth, trace);
+				if (trace)
+					WriteChromeTraceFile(command_trace, trace_filename);
+				Display(image_input, image_output);
+			}
+			return 0;
 		}
 
+		//Part 3 - host operations
+		//3.1 Select computing devices
+		start = chrono::steady_clock::now();
+		cl::Context context = GetContext(platform_id, device_id);
+		AddHostStage(report, "context", start);
+		//display the selected device
+		std::cout << "Running on " << GetPlatformName(platform_id) << ", " << GetDeviceName(platform_id, device_id) << std::endl;
+
+		//Validation mode, exits with 1 if any kernel is not exact
+		if (validate) {
+			bool exact;
+			if (bit_depth > 8)
+				exact = ValidateKernels(context, ReadImage<unsigned short>(image_filename, max_pixel_value), nr_bins, bit_depth, validate_kernel);
+			else
+				exact = ValidateKernels(context, ReadImage<unsigned char>(image_filename, max_pixel_value), nr_bins, bit_depth, validate_kernel);
+			std::cout << (exact ? "All kernels exact" : "Some kernels are NOT exact") << std::endl;
+			return exact ? 0 : 1;
+		}
 
-		while (!disp_input.is_closed() && !disp_output.is_closed()
-			&& !disp_input.is_keyESC() && !disp_output.is_keyESC()) {
-			disp_input.wait(1);
-			disp_output.wait(1);
+		//the report is printed before the images are shown, the display waits for the user
+		if (bit_depth > 8) {
+			start = chrono::steady_clock::now();
+			CImg<unsigned short> image_input = ReadImage<unsigned short>(image_filename, max_pixel_value); //16bit
+			AddHostStage(report, "decode", start);
+			CImg<unsigned short> image_output = Equalise(context, image_input, nr_bins, bit_depth, retune, explain, report, trace);
+			PrintFrameReport(report, report_filename);
+			if (trace)
+				WriteChromeTraceFile(command_trace, trace_filename);
+			Display(image_input, image_output);
+		}
+		else {
+			start = chrono::steady_clock::now();
+			CImg<unsigned char> image_input = ReadImage<unsigned char>(image_filename, max_pixel_value); //8bit
+			AddHostStage(report, "decode", start);
+			CImg<unsigned char> image_output = Equalise(context, image_input, nr_bins, bit_depth, retune, explain, report, trace);
+			PrintFrameReport(report, report_filename);
+			if (trace)
+				WriteChromeTraceFile(command_trace, trace_filename);
+			Display(image_input, image_output);
 		}
-		
 	}
 	catch (const cl::Error& err) {
 		std::cerr << "ERROR: " << err.what() << ", " << getErrorString(err.err()) << std::endl;
@@ -245,4 +386,4 @@ int main(int argc, char** argv) {
 	}
 
 	return 0;
-}
\ No newline at end of file
+}
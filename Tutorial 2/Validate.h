@@ -0,0 +1,283 @@
+#pragma once
+
+#include <functional>
+#include "Utils.h"
+#include "CImg.h"
+#include "Tuning.h"
+#include "Dispatch.h"
+#include "Pipeline.h"
+#include "Reference.h"
+#include "HistogramEqualizer.h"
+
+using namespace cimg_library;
+
+//--validate: runs every kernel variant that can run this image on the device, over every launch setting the autotuner could pick,
+//and diffs its result against the scalar reference of Reference.h. Each step gets the reference result of the step before as input,
+//so a mismatch points at one kernel. Then the library as the application uses it (dispatcher and tuned settings) is checked end to end.
+//Only exact results pass, the kernels are integer code and have no excuse to be off by one. A kernel that runs none of its
+//settings fails too, the dispatcher would still pick it.
+template <typename T>
+bool ValidateKernels(const cl::Context& context, const CImg<T>& image_input, int nr_bins, int bit_depth, const string& only_kernel = "") {
+	cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+	DeviceCaps caps = ProbeDevice(device);
+	cl::CommandQueue queue(context, device);
+	cl::Program::Sources sources;
+	AddKernelSources(sources);
+	cl::Program program = BuildKernelProgram(context, device, caps, bit_depth, sources);
+
+	const int channels = image_input.spectrum();
+	const size_t channel_size = (size_t)image_input.width() * image_input.height() * image_input.depth();
+	const size_t levels = (size_t)1 << bit_depth;
+	const size_t histogram_bytes = sizeof(cl_uint) * nr_bins * channels;
+	cl_uint bin_mul, bin_shift;
+	GetBinMapping(nr_bins, bit_depth, bin_mul, bin_shift);
+
+	vector<unsigned int> histogram = ReferenceHistogram(image_input.data(), channel_size, channels, nr_bins, bit_depth);
+	vector<unsigned int> cdf = ReferenceCdf(histogram, channels, nr_bins);
+	vector<T> lut = ReferenceLut<T>(cdf, channels, nr_bins, bit_depth);
+	vector<T> output = ReferenceApply(image_input.data(), lut, channel_size, channels, bit_depth);
+
+	cl::Buffer dev_image(context, CL_MEM_READ_ONLY, image_input.size() * sizeof(T));
+	cl::Buffer dev_output(context, CL_MEM_WRITE_ONLY, image_input.size() * sizeof(T));
+	cl::Buffer dev_histogram(context, CL_MEM_READ_WRITE, histogram_bytes);
+	cl::Buffer dev_cumulative_histogram(context, CL_MEM_READ_WRITE, histogram_bytes);
+	cl::Buffer dev_lut(context, CL_MEM_READ_WRITE, sizeof(T) * lut.size());
+	queue.enqueueWriteBuffer(dev_image, CL_TRUE, 0, image_input.size() * sizeof(T), image_input.data());
+
+	bool all_exact = true;
+	auto selected = [&](const string& name) { return only_kernel.empty() || only_kernel == name; };
+	auto work_group_sizes = [&](const cl::Kernel& kernel) {
+		return GetWorkGroupCandidates(min(caps.max_work_group_size, kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device)));
+	};
+	//runs check() for every config, prints the mismatches and a line per kernel. Settings the device rejects are skipped, but at least one has to run.
+	auto validate = [&](const string& name, const vector<LaunchConfig>& configs, const std::function<string(const LaunchConfig&)>& check) {
+		size_t exact = 0, failed = 0, skipped = 0;
+		for (const LaunchConfig& config : configs) {
+			string diff;
+			try {
+				diff = check(config);
+			}
+			catch (const cl::Error& err) {
+				skipped++; //e.g. CL_INVALID_WORK_GROUP_SIZE, a setting the tuner would skip as well
+				if (skipped == configs.size())
+					std::cout << "  " << name << ": " << err.what() << ", " << getErrorString(err.err()) << std::endl;
+				continue;
+			}
+			if (diff.empty()) {
+				exact++;
+				continue;
+			}
+			failed++;
+			std::cout << "  " << name;
+			if (config.work_group_size > 0)
+				std::cout << " (work group " << config.work_group_size << ", " << config.pixels_per_item << " pixels per item, " << config.replicas << " replicas)";
+			std::cout << ": " << diff << std::endl;
+		}
+		const bool passed = failed == 0 && exact > 0;
+		std::cout << (passed ? "ok   " : "FAIL ") << name << ": " << exact << " exact, " << failed << " wrong, " << skipped << " not launchable" << std::endl;
+		all_exact = all_exact && passed;
+	};
+
+	//histogram kernels, from a zeroed histogram every time
+	bool bins_fit_local = histogram_bytes / channels <= caps.local_mem_size;
+	vector<string> histogram_kernels = { "histogram_global" };
+	if (bins_fit_local)
+		histogram_kernels.push_back("histogram_local");
+	if (nr_bins <= PRIVATE_BINS)
+		histogram_kernels.push_back("histogram_private");
+	if (bins_fit_local && caps.subgroups)
+		histogram_kernels.push_back("histogram_subgroup");
+	for (const string& name : histogram_kernels) {
+		if (!selected(name))
+			continue;
+		cl::Kernel kernel(program, name.c_str());
+		vector<LaunchConfig> configs;
+		for (size_t work_group_size : work_group_sizes(kernel)) {
+			for (cl_uint pixels_per_item : { 1, 4, 16, 64, 256 }) {
+				for (cl_uint replicas = 1; replicas <= (name == "histogram_local" ? 8u : 1u) && sizeof(cl_uint) * nr_bins * replicas <= caps.local_mem_size; replicas *= 2) {
+					LaunchConfig config;
+					config.work_group_size = work_group_size;
+					config.pixels_per_item = pixels_per_item;
+					config.replicas = replicas;
+					configs.push_back(config);
+				}
+			}
+		}
+		validate(name, configs, [&](const LaunchConfig& config) {
+			queue.enqueueFillBuffer(dev_histogram, (cl_uint)0, 0, histogram_bytes);
+			EnqueueHistogram(queue, kernel, name, dev_image, dev_histogram, channel_size, channels, nr_bins, bin_mul, bin_shift, config);
+			vector<unsigned int> result(histogram.size());
+			queue.enqueueReadBuffer(dev_histogram, CL_TRUE, 0, histogram_bytes, result.data());
+			return DiffExact(histogram, result);
+		});
+	}
+
+	//scans of the reference histogram
+	queue.enqueueWriteBuffer(dev_histogram, CL_TRUE, 0, histogram_bytes, histogram.data());
+	vector<string> scan_kernels = { "scan_blocked" };
+	if ((size_t)nr_bins <= caps.max_work_group_size && sizeof(cl_uint) * nr_bins <= caps.local_mem_size)
+		scan_kernels.push_back("scan_local");
+	for (const string& name : scan_kernels) {
+		if (!selected(name))
+			continue;
+		cl::Kernel kernel(program, name.c_str());
+		vector<LaunchConfig> configs;
+		for (size_t work_group_size : name == "scan_local" ? vector<size_t>{ (size_t)nr_bins } : work_group_sizes(kernel)) {
+			LaunchConfig config;
+			config.work_group_size = work_group_size;
+			configs.push_back(config);
+		}
+		validate(name, configs, [&](const LaunchConfig& config) {
+			EnqueueScan(queue, kernel, dev_histogram, dev_cumulative_histogram, channels, nr_bins, config);
+			vector<unsigned int> result(cdf.size());
+			queue.enqueueReadBuffer(dev_cumulative_histogram, CL_TRUE, 0, histogram_bytes, result.data());
+			return DiffExact(cdf, result);
+		});
+	}
+
+	//LUT from the reference cumulative histogram
+	queue.enqueueWriteBuffer(dev_cumulative_histogram, CL_TRUE, 0, histogram_bytes, cdf.data());
+	if (selected("lut_build")) {
+		cl::Kernel kernel(program, "lut_build");
+		validate("lut_build", { LaunchConfig() }, [&](const LaunchConfig&) {
+			EnqueueLutBuild(queue, kernel, dev_cumulative_histogram, dev_lut, channels, nr_bins, levels, bin_mul, bin_shift);
+			vector<T> result(lut.size());
+			queue.enqueueReadBuffer(dev_lut, CL_TRUE, 0, sizeof(T) * lut.size(), result.data());
+			return DiffExact(lut, result);
+		});
+	}
+	if (selected("lut_build_reciprocal")) {
+		cl::Kernel reciprocal_kernel(program, "lut_reciprocal");
+		cl::Kernel kernel(program, "lut_build_reciprocal");
+		cl::Buffer dev_reciprocals(context, CL_MEM_READ_WRITE, sizeof(cl_ulong) * 4 * channels);
+		validate("lut_build_reciprocal", { LaunchConfig() }, [&](const LaunchConfig&) {
+			EnqueueLutBuildReciprocal(queue, reciprocal_kernel, kernel, dev_cumulative_histogram, dev_reciprocals, dev_lut, channels, nr_bins, levels, bin_mul, bin_shift);
+			vector<T> result(lut.size());
+			queue.enqueueReadBuffer(dev_lut, CL_TRUE, 0, sizeof(T) * lut.size(), result.data());
+			return DiffExact(lut, result);
+		});
+	}
+
+	//the reference LUT applied to the image
+	queue.enqueueWriteBuffer(dev_lut, CL_TRUE, 0, sizeof(T) * lut.size(), lut.data());
+	for (const string& name : { string("lut_apply"), string("lut_apply_vec") }) {
+		if (!selected(name))
+			continue;
+		cl::Kernel kernel(program, name.c_str());
+		vector<LaunchConfig> configs;
+		for (size_t work_group_size : work_group_sizes(kernel)) {
+			LaunchConfig config;
+			config.work_group_size = work_group_size;
+			configs.push_back(config);
+		}
+		validate(name, configs, [&](const LaunchConfig& config) {
+			EnqueueLut(queue, kernel, name, dev_image, dev_output, dev_lut, channel_size, channels, levels, config);
+			vector<T> result(output.size());
+			queue.enqueueReadBuffer(dev_output, CL_TRUE, 0, sizeof(T) * output.size(), result.data());
+			return DiffExact(output, result);
+		});
+	}
+	//the same through images, the stacked channels are width x (rows * channels). Only where the format and the sizes let the
+	//dispatcher consider it, anywhere else the kernel can never run.
+	const size_t width = image_input.width();
+	const size_t rows = (size_t)image_input.height() * image_input.depth();
+	const bool image_lut = caps.image_support && (bit_depth > 8 ? caps.image_r16 : caps.image_r8) && width <= caps.image2d_max_width &&
+		rows * channels <= caps.image2d_max_height && lut.size() <= caps.image_max_buffer_size;
+	if (!image_lut && selected("lut_apply_image"))
+		std::cout << "     lut_apply_image: not checked, no images, no CL_R format or the image is over the size limits" << std::endl;
+	if (image_lut && selected("lut_apply_image")) {
+		cl::Kernel kernel(program, "lut_apply_image");
+		vector<LaunchConfig> configs;
+		for (size_t work_group_size : work_group_sizes(kernel)) {
+			LaunchConfig config;
+			config.work_group_size = work_group_size;
+			configs.push_back(config);
+		}
+		const cl::ImageFormat image_format = GetLutImageFormat(bit_depth);
+		validate("lut_apply_image", configs, [&](const LaunchConfig& config) {
+			cl::Image2D dev_input_image(context, CL_MEM_READ_ONLY, image_format, width, rows * channels);
+			cl::Image2D dev_output_image(context, CL_MEM_WRITE_ONLY, image_format, width, rows * channels);
+			cl::Image1DBuffer dev_lut_image(context, CL_MEM_READ_ONLY, image_format, lut.size(), dev_lut);
+			queue.enqueueCopyBufferToImage(dev_image, dev_input_image, 0, { 0, 0, 0 }, { width, rows * channels, 1 });
+			EnqueueLutImage(queue, kernel, dev_input_image, dev_output_image, dev_lut_image, width, rows, channels, levels, config);
+			vector<T> result(output.size());
+			queue.enqueueReadImage(dev_output_image, CL_TRUE, { 0, 0, 0 }, { width, rows * channels, 1 }, 0, 0, result.data());
+			return DiffExact(output, result);
+		});
+	}
+
+	//batched kernels on a batch of the image and its left half (different sizes, so the offsets matter), each image against its own reference
+	if (sizeof(cl_uint) * nr_bins <= caps.local_mem_size && (selected("histogram_batched") || selected("lut_apply_batched"))) {
+		const CImg<T> half = image_input.get_crop(0, 0, 0, 0, (image_input.width() - 1) / 2, image_input.height() - 1, image_input.depth() - 1, channels - 1);
+		vector<cl_uint> offsets = { 0, (cl_uint)image_input.size(), (cl_uint)(image_input.size() + half.size()) };
+		vector<T> batch(image_input.data(), image_input.data() + image_input.size());
+		batch.insert(batch.end(), half.data(), half.data() + half.size());
+		const size_t slices = 2 * channels;
+		vector<unsigned int> batch_histogram = histogram;
+		vector<T> batch_lut = lut, batch_output = output;
+		vector<unsigned int> half_histogram = ReferenceHistogram(half.data(), half.size() / channels, channels, nr_bins, bit_depth);
+		vector<T> half_lut = ReferenceLut<T>(ReferenceCdf(half_histogram, channels, nr_bins), channels, nr_bins, bit_depth);
+		vector<T> half_output = ReferenceApply(half.data(), half_lut, half.size() / channels, channels, bit_depth);
+		batch_histogram.insert(batch_histogram.end(), half_histogram.begin(), half_histogram.end());
+		batch_lut.insert(batch_lut.end(), half_lut.begin(), half_lut.end());
+		batch_output.insert(batch_output.end(), half_output.begin(), half_output.end());
+
+		cl::Buffer dev_batch(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(T) * batch.size(), batch.data());
+		cl::Buffer dev_offsets(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(cl_uint) * offsets.size(), offsets.data());
+		cl::Buffer dev_batch_histogram(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * batch_histogram.size());
+		cl::Buffer dev_batch_lut(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(T) * batch_lut.size(), batch_lut.data());
+		cl::Buffer dev_batch_output(context, CL_MEM_WRITE_ONLY, sizeof(T) * batch.size());
+		for (const string& name : { string("histogram_batched"), string("lut_apply_batched") }) {
+			if (!selected(name))
+				continue;
+			cl::Kernel kernel(program, name.c_str());
+			vector<LaunchConfig> configs;
+			for (size_t work_group_size : work_group_sizes(kernel)) {
+				for (cl_uint pixels_per_item : { 1, 4, 16, 64 }) {
+					LaunchConfig config;
+					config.work_group_size = work_group_size;
+					config.pixels_per_item = pixels_per_item;
+					configs.push_back(config);
+				}
+			}
+			validate(name, configs, [&](const LaunchConfig& config) {
+				if (name == "histogram_batched") {
+					queue.enqueueFillBuffer(dev_batch_histogram, (cl_uint)0, 0, sizeof(cl_uint) * batch_histogram.size());
+					EnqueueHistogramBatched(queue, kernel, dev_batch, dev_offsets, dev_batch_histogram, slices, channels, nr_bins, bin_mul, bin_shift, channel_size, config);
+					vector<unsigned int> result(batch_histogram.size());
+					queue.enqueueReadBuffer(dev_batch_histogram, CL_TRUE, 0, sizeof(cl_uint) * result.size(), result.data());
+					return DiffExact(batch_histogram, result);
+				}
+				EnqueueLutBatched(queue, kernel, dev_batch, dev_batch_output, dev_offsets, dev_batch_lut, slices, channels, levels, channel_size, config);
+				vector<T> result(batch_output.size());
+				queue.enqueueReadBuffer(dev_batch_output, CL_TRUE, 0, sizeof(T) * result.size(), result.data());
+				return DiffExact(batch_output, result);
+			});
+		}
+	}
+
+	//the library with the kernels and settings the dispatcher and the tuning file pick
+	if (selected("library")) {
+		EqualizerFormat format;
+		format.width = image_input.width();
+		format.height = (size_t)image_input.height() * image_input.depth();
+		format.channels = channels;
+		format.bit_depth = bit_depth;
+		format.nr_bins = nr_bins;
+		EqualizerOptions options;
+		options.tuning_file = GetTuningFileName(device);
+		HistogramEqualizer<T> equalizer(context, format, options);
+		validate("library (" + equalizer.plan().histogram + ", " + equalizer.plan().scan + ", " + equalizer.plan().lut + ")", { LaunchConfig() },
+			[&](const LaunchConfig&) {
+			vector<unsigned int> result_cdf(cdf.size());
+			vector<T> result(output.size());
+			equalizer.equalize({ image_input.data(), image_input.size() }, result, result_cdf);
+			string diff = DiffExact(cdf, result_cdf);
+			if (!diff.empty())
+				return "cumulative histogram: " + diff;
+			diff = DiffExact(output, result);
+			return diff.empty() ? diff : "output: " + diff;
+		});
+	}
+	return all_exact;
+}
@@ -0,0 +1,157 @@
+//Client for the equalisation service (Tutorial 2 --serve), sends one job per input image and prints the replies.
+//Needs no OpenCL, e.g. g++ -O2 -o equalise_client equalise_client.cpp -lrt
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include "Socket.h"
+#include "FrameRing.h"
+
+void print_help() {
+	std::cerr << "Application usage: equalise_client [options] input [input ...]" << std::endl;
+
+	std::cerr << "  -s : service socket (default: " << DEFAULT_SOCKET_PATH << ")" << std::endl;
+	std::cerr << "  -o : output file of the next input (default: input name with _equalised)" << std::endl;
+	std::cerr << "  -b : number of bins (default: whatever the service was started with)" << std::endl;
+	std::cerr << "  --frame ring slot : equalise a frame the producer left in a shared memory ring (see FrameRing.h)" << std::endl;
+	std::cerr << "  --produce ring frames width height bit_depth : create a ring with two slots and stream frames of noise through it" << std::endl;
+	std::cerr << "  --close ring : make the service unmap a ring" << std::endl;
+	std::cerr << "  --ping : check that the service is running" << std::endl;
+	std::cerr << "  --shutdown : stop the service" << std::endl;
+	std::cerr << "  -h : print this message" << std::endl;
+}
+
+//Producer side of a frame ring, e.g. to try the shared memory path without a camera: creates the ring, fills a free slot with
+//noise, hands it over with a frame request and frees the slot again once the reply is there. The ring is closed on the service
+//and removed at the end. Returns the number of frames that failed, -1 if the connection was lost.
+int ProduceFrames(int fd, const std::string& request) {
+	std::vector<std::string> fields = SplitFields(request);
+	const std::string& name = fields[1];
+	int frames = atoi(fields[2].c_str());
+	uint32_t width = (uint32_t)strtoul(fields[3].c_str(), NULL, 10);
+	uint32_t height = (uint32_t)strtoul(fields[4].c_str(), NULL, 10);
+	uint32_t bit_depth = (uint32_t)strtoul(fields[5].c_str(), NULL, 10);
+	size_t frame_bytes;
+	if (bit_depth < 1 || bit_depth > 16 || width < 1 || height < 1 || !GetFrameBytes(width, height, 1, bit_depth, frame_bytes)) {
+		std::cerr << "ERROR: bad frame size" << std::endl;
+		return 1;
+	}
+
+	FrameRing ring;
+	if (!CreateFrameRing(ring, name, 2, frame_bytes)) {
+		std::cerr << "ERROR: cannot create frame ring " << name << ": " << strerror(errno) << std::endl;
+		return 1;
+	}
+	std::mt19937 generator(1);
+	int failed = 0;
+	std::string buffer, reply;
+	for (int i = 0; i < frames; i++) {
+		uint32_t slot_id = (uint32_t)i % ring.layout.slot_count;
+		FrameSlot& slot = GetFrameSlot(ring, slot_id);
+		slot.width = width;
+		slot.height = height;
+		slot.channels = 1;
+		slot.bit_depth = bit_depth;
+		slot.nr_bins = 0;
+		slot.sequence = (uint64_t)i;
+		unsigned char* input = GetFrameInput(ring, slot_id);
+		for (size_t p = 0; p < (size_t)width * height; p++) {
+			uint32_t value = generator() & ((1u << bit_depth) - 1);
+			if (bit_depth > 8)
+				reinterpret_cast<uint16_t*>(input)[p] = (uint16_t)value;
+			else
+				input[p] = (unsigned char)value;
+		}
+		slot.state.store(FRAME_READY, std::memory_order_release);
+
+		if (!SendLine(fd, "frame\t" + name + "\t" + std::to_string(slot_id)) || !ReceiveLine(fd, buffer, reply)) {
+			CloseFrameRing(ring, true);
+			return -1;
+		}
+		fields = SplitFields(reply);
+		if (!fields.empty() && fields[0] == "ok" && slot.state.load(std::memory_order_acquire) == FRAME_DONE) {
+			std::cout << "frame " << i << ": " << (fields.size() > 2 ? fields[2] : "?") << " ms" << std::endl;
+		}
+		else {
+			std::cerr << "ERROR: frame " << i << ": " << (fields.size() > 1 ? fields[1] : reply) << std::endl;
+			failed++;
+		}
+		slot.state.store(FRAME_FREE, std::memory_order_release);
+	}
+
+	//the service keeps rings mapped, it has to let go before the name can be reused
+	bool closed = SendLine(fd, "close\t" + name) && ReceiveLine(fd, buffer, reply);
+	CloseFrameRing(ring, true);
+	return closed ? failed : -1;
+}
+
+int main(int argc, char** argv) {
+	std::string socket_path = DEFAULT_SOCKET_PATH;
+	std::string nr_bins;
+	std::string next_output;
+	std::vector<std::string> requests;
+
+	for (int i = 1; i < argc; i++) {
+		if ((strcmp(argv[i], "-s") == 0) && (i < (argc - 1))) { socket_path = argv[++i]; }
+		else if ((strcmp(argv[i], "-o") == 0) && (i < (argc - 1))) { next_output = argv[++i]; }
+		else if ((strcmp(argv[i], "-b") == 0) && (i < (argc - 1))) { nr_bins = argv[++i]; }
+		else if ((strcmp(argv[i], "--frame") == 0) && (i < (argc - 2))) { requests.push_back(std::string("frame\t") + argv[i + 1] + "\t" + argv[i + 2]); i += 2; }
+		else if ((strcmp(argv[i], "--produce") == 0) && (i < (argc - 5))) {
+			requests.push_back(std::string("produce\t") + argv[i + 1] + "\t" + argv[i + 2] + "\t" + argv[i + 3] + "\t" + argv[i + 4] + "\t" + argv[i + 5]);
+			i += 5;
+		}
+		else if ((strcmp(argv[i], "--close") == 0) && (i < (argc - 1))) { requests.push_back(std::string("close\t") + argv[++i]); }
+		else if (strcmp(argv[i], "--ping") == 0) { requests.push_back("ping"); }
+		else if (strcmp(argv[i], "--shutdown") == 0) { requests.push_back("shutdown"); }
+		else if (strcmp(argv[i], "-h") == 0) { print_help(); return 0; }
+		else {
+			std::string request = std::string("equalise\t") + argv[i] + "\t" + next_output;
+			if (!nr_bins.empty())
+				request += "\t" + nr_bins;
+			requests.push_back(request);
+			next_output.clear();
+		}
+	}
+	if (requests.empty()) {
+		print_help();
+		return 1;
+	}
+
+	int fd = ConnectUnixSocket(socket_path);
+	if (fd < 0) {
+		std::cerr << "Unable to connect to " << socket_path << ": " << strerror(errno) << std::endl;
+		return 1;
+	}
+
+	//one request at a time, the service answers in order
+	int failed = 0;
+	std::string buffer, reply;
+	for (const std::string& request : requests) {
+		if (request.compare(0, 8, "produce\t") == 0) {
+			int produce_failed = ProduceFrames(fd, request);
+			if (produce_failed < 0) {
+				std::cerr << "Connection lost" << std::endl;
+				close(fd);
+				return 1;
+			}
+			failed += produce_failed;
+			continue;
+		}
+		if (!SendLine(fd, request) || !ReceiveLine(fd, buffer, reply)) {
+			std::cerr << "Connection lost" << std::endl;
+			close(fd);
+			return 1;
+		}
+		std::vector<std::string> fields = SplitFields(reply);
+		if (!fields.empty() && fields[0] == "ok") {
+			std::cout << (fields.size() > 2 ? fields[1] + " (" + fields[2] + " ms)" : "ok") << std::endl;
+		}
+		else {
+			std::cerr << "ERROR: " << (fields.size() > 1 ? fields[1] : reply) << std::endl;
+			failed++;
+		}
+	}
+
+	close(fd);
+	return failed == 0 ? 0 : 1;
+}
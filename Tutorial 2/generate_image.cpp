@@ -0,0 +1,62 @@
+//Writes a synthetic test image (see ImageGenerator.h), e.g. a 200 MP 16-bit worst case for the histogram atomics:
+//	generate_image -W 16384 -H 12288 -b 16 -t constant -o constant_16bit.pgm
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include "ImageGenerator.h"
+
+void print_help() {
+	std::cerr << "Application usage:" << std::endl;
+
+	std::cerr << "  -W : width in pixels (default: 1024)" << std::endl;
+	std::cerr << "  -H : height in pixels (default: 1024)" << std::endl;
+	std::cerr << "  -c : channels, 1 for mono or 3 for colour (default: 1)" << std::endl;
+	std::cerr << "  -b : bit depth, 1 to 16 (default: 8)" << std::endl;
+	std::cerr << "  -t : distribution, uniform, gaussian, constant, bimodal or natural (default: uniform)" << std::endl;
+	std::cerr << "  -s : random seed (default: 1)" << std::endl;
+	std::cerr << "  -o : output file (default: <distribution>_<width>x<height>_<bits>bit.pgm or .ppm)" << std::endl;
+	std::cerr << "  -h : print this message" << std::endl;
+}
+
+int main(int argc, char** argv) {
+	size_t width = 1024;
+	size_t height = 1024;
+	int channels = 1;
+	int bit_depth = 8;
+	Distribution distribution = Distribution::Uniform;
+	unsigned int seed = 1;
+	std::string file_name;
+
+	for (int i = 1; i < argc; i++) {
+		if ((strcmp(argv[i], "-W") == 0) && (i < (argc - 1))) { width = strtoul(argv[++i], NULL, 10); }
+		else if ((strcmp(argv[i], "-H") == 0) && (i < (argc - 1))) { height = strtoul(argv[++i], NULL, 10); }
+		else if ((strcmp(argv[i], "-c") == 0) && (i < (argc - 1))) { channels = atoi(argv[++i]); }
+		else if ((strcmp(argv[i], "-b") == 0) && (i < (argc - 1))) { bit_depth = atoi(argv[++i]); }
+		else if ((strcmp(argv[i], "-t") == 0) && (i < (argc - 1))) {
+			if (!ParseDistribution(argv[++i], distribution)) {
+				std::cerr << "Unknown distribution " << argv[i] << std::endl;
+				return 1;
+			}
+		}
+		else if ((strcmp(argv[i], "-s") == 0) && (i < (argc - 1))) { seed = (unsigned int)strtoul(argv[++i], NULL, 10); }
+		else if ((strcmp(argv[i], "-o") == 0) && (i < (argc - 1))) { file_name = argv[++i]; }
+		else if (strcmp(argv[i], "-h") == 0) { print_help(); return 0; }
+	}
+
+	if (width == 0 || height == 0 || (channels != 1 && channels != 3) || bit_depth < 1 || bit_depth > 16) {
+		print_help();
+		return 1;
+	}
+	if (file_name.empty()) {
+		file_name = std::string(GetDistributionName(distribution)) + "_" + std::to_string(width) + "x" + std::to_string(height) + "_"
+			+ std::to_string(bit_depth) + "bit" + (channels == 1 ? ".pgm" : ".ppm");
+	}
+
+	bool written = bit_depth > 8
+		? WritePnm(file_name, GenerateImage<unsigned short>(width, height, channels, bit_depth, distribution, seed), bit_depth)
+		: WritePnm(file_name, GenerateImage<unsigned char>(width, height, channels, bit_depth, distribution, seed), bit_depth);
+	if (!written)
+		return 1;
+	std::cout << file_name << std::endl;
+	return 0;
+}
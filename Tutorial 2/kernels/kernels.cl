@@ -1,125 +1,404 @@
 
-//This kernel can use a variety of different nr_bin values.
-kernel void cumulative_histogram(global const unsigned char* image, global int* cumulative_histogram,const int nr_bins) {
-	const int id = get_global_id(0);
-	const int local_id = get_local_id(0);
-	const int group_id = get_group_id(0);
-	const int image_size = get_global_size(0);
-	const int global_id = get_global_id(0);
-
-	// Local memory for storing the local scan result (YOU WILL HAVE TO CHANGE THIS TO USE 16BIT OR CHANGE BIN VALUES)	
-	//8192 is max for 16bit
-	local int local_histogram[256]; //for some reason putting nr_bins here gives an error!	
-
-	if (image[id] < nr_bins)
-		local_histogram[local_id] = 1;
-	else
-		local_histogram[local_id] = 0; //initalise with zeros
+//The pixel type is picked by the host when building the program (-DPIXEL=uchar or -DPIXEL=ushort)
+//so the same kernels are used for 8-bit and 16-bit images
+#ifndef PIXEL
+#define PIXEL uchar
+#endif
 
+//vector version of the pixel type (uchar4 or ushort4)
+#define CONCAT(a, b) a##b
+#define VECTOR_TYPE(type, n) CONCAT(type, n)
+#define PIXEL4 VECTOR_TYPE(PIXEL, 4)
+
+//value to bin mapping, bin = value * nr_bins >> bit_depth
+//the host cancels the common powers of two first so bin_mul and bin_shift stay small
+//(for power of two bin counts bin_mul is 1 and this is a plain shift)
+uint to_bin(uint value, const uint bin_mul, const uint bin_shift) {
+	return (value * bin_mul) >> bin_shift;
+}
+
+//All histogram kernels use the same 2D range: dimension 0 covers the pixels of one channel
+//(padded up to a multiple of the work group size) and dimension 1 is the channel (1 for mono, 3 for colour).
+//The histogram holds nr_bins values per channel and has to be zeroed by the host before the launch.
+
+//Histogram with a local copy per work group, nr_bins * replicas * sizeof(uint) has to fit into local memory.
+//local_histogram is sized by the host (cl::Local) so any nr_bins can be used. The work items are spread over
+//several copies (replicas) of the histogram to cut down on atomic contention, the copies are added up at the end.
+kernel void histogram_local(global const PIXEL* image, global uint* histogram, local uint* local_histogram,
+	const uint channel_size, const uint nr_bins, const uint bin_mul, const uint bin_shift, const uint replicas) {
+	const uint id = get_global_id(0);
+	const uint channel = get_global_id(1);
+	const uint local_id = get_local_id(0);
+	const uint local_size = get_local_size(0);
+	const uint stride = get_global_size(0);
+	global const PIXEL* channel_image = image + (size_t)channel * channel_size;
+	local uint* replica = local_histogram + (local_id % replicas) * nr_bins;
+
+	//clear the local histogram, there can be more bins than work items
+	for (uint i = local_id; i < nr_bins * replicas; i += local_size)
+		local_histogram[i] = 0;
 	barrier(CLK_LOCAL_MEM_FENCE);
 
-	//An attempt to replace atomic_inc. It runs but just gives a slightly darker image.
-	// I thought it was working correctly lol
-	//Your are welcome to check if it runs or not (it should for 8bit)
-	//for (int stride = 1; stride < get_local_size(0); stride *= 2) { 
-	//	int index = local_id + stride;
-	//	if (index < nr_bins) {
-	//		local_histogram[index] += local_histogram[index - stride];
-	//	}
-	//	barrier(CLK_LOCAL_MEM_FENCE);
-	//}
-
-	atomic_inc(&local_histogram[image[global_id]]); //increment count
-	barrier(CLK_LOCAL_MEM_FENCE); //synchronisation
-
-	// partial to global
-	if (id < nr_bins) {
-		cumulative_histogram[id] = local_histogram[local_id];
-	}
-	barrier(CLK_GLOBAL_MEM_FENCE); //kinda neccessary to avoid race conditions
-
-	////Blelloch up sweep
-	////Wow what a clever use of this algorithm
-	////start at 1, double with each iteration
-	for (int stride = 1; stride * 2 <= image_size; stride *= 2) { 
-		//index = global id - size of stride
-		int index = id - stride;
-		if (index >= 0 && index < nr_bins) { 
-			//replacing atomic add
-			cumulative_histogram[id] += cumulative_histogram[index]; 
+	//the host can launch fewer work items than pixels, each one then strides over several pixels
+	for (uint i = id; i < channel_size; i += stride)
+		atomic_inc(&replica[to_bin(channel_image[i], bin_mul, bin_shift)]);
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	//partial to global
+	for (uint i = local_id; i < nr_bins; i += local_size) {
+		uint sum = 0;
+		for (uint r = 0; r < replicas; r++)
+			sum += local_histogram[r * nr_bins + i];
+		if (sum != 0)
+			atomic_add(&histogram[channel * nr_bins + i], sum);
+	}
+}
+
+//Fallback for bin counts that do not fit into local memory (e.g. 65536 bins for 16-bit), every pixel goes straight to global memory
+kernel void histogram_global(global const PIXEL* image, global uint* histogram,
+	const uint channel_size, const uint nr_bins, const uint bin_mul, const uint bin_shift) {
+	const uint id = get_global_id(0);
+	const uint channel = get_global_id(1);
+	const uint stride = get_global_size(0);
+	global const PIXEL* channel_image = image + (size_t)channel * channel_size;
+
+	for (uint i = id; i < channel_size; i += stride)
+		atomic_inc(&histogram[channel * nr_bins + to_bin(channel_image[i], bin_mul, bin_shift)]);
+}
+
+//Inclusive scan of the histogram, one work group per channel (dimension 1).
+//Each work item sums a block of consecutive bins, the block sums are scanned in local memory (Hillis-Steele)
+//and every work item then writes out its block. Works for any nr_bins with a single work group.
+kernel void scan_blocked(global const uint* histogram, global uint* cumulative_histogram, local uint* block_sums, const uint nr_bins) {
+	const uint local_id = get_local_id(0);
+	const uint local_size = get_local_size(0);
+	const uint offset = get_global_id(1) * nr_bins;
+	const uint block = (nr_bins + local_size - 1) / local_size;
+	const uint start = min(local_id * block, nr_bins);
+	const uint end = min(start + block, nr_bins);
+
+	uint sum = 0;
+	for (uint i = start; i < end; i++)
+		sum += histogram[offset + i];
+	block_sums[local_id] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	//read and write are separated by a barrier so no second buffer is needed
+	for (uint stride = 1; stride < local_size; stride *= 2) {
+		uint value = (local_id >= stride) ? block_sums[local_id - stride] : 0;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		block_sums[local_id] += value;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	//exclusive prefix of this block, then walk through it
+	sum = block_sums[local_id] - sum;
+	for (uint i = start; i < end; i++) {
+		sum += histogram[offset + i];
+		cumulative_histogram[offset + i] = sum;
+	}
+}
+
+//Inclusive scan for nr_bins <= work group size: one bin per work item and a Hillis-Steele scan in local memory.
+//Launched with exactly nr_bins work items per channel, so it is a single pass instead of the blocked version.
+kernel void scan_local(global const uint* histogram, global uint* cumulative_histogram, local uint* scratch, const uint nr_bins) {
+	const uint local_id = get_local_id(0);
+	const uint offset = get_global_id(1) * nr_bins;
+
+	scratch[local_id] = histogram[offset + local_id];
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (uint stride = 1; stride < nr_bins; stride *= 2) {
+		uint value = (local_id >= stride) ? scratch[local_id - stride] : 0;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		scratch[local_id] += value;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	cumulative_histogram[offset + local_id] = scratch[local_id];
+}
+
+//Applies the look up table, which has one entry per possible pixel value (levels = 2^bit_depth) for every channel.
+//Same 2D range as the histogram kernels, one pixel per work item.
+kernel void lut_apply(global const PIXEL* image, global PIXEL* output, global const PIXEL* lut, const uint channel_size, const uint levels) {
+	const uint id = get_global_id(0);
+	const uint channel = get_global_id(1);
+
+	if (id < channel_size) {
+		size_t i = (size_t)channel * channel_size + id;
+		output[i] = lut[channel * levels + image[i]];
+	}
+}
+
+//Same as lut_apply but 4 pixels per work item with vector loads and stores, for devices that prefer vectors (most CPUs).
+//The last work item of a channel finishes any leftover pixels one at a time.
+kernel void lut_apply_vec(global const PIXEL* image, global PIXEL* output, global const PIXEL* lut, const uint channel_size, const uint levels) {
+	const uint id = get_global_id(0) * 4;
+	const uint channel = get_global_id(1);
+	global const PIXEL* channel_image = image + (size_t)channel * channel_size;
+	global PIXEL* channel_output = output + (size_t)channel * channel_size;
+	global const PIXEL* channel_lut = lut + channel * levels;
+
+	if (id + 4 <= channel_size) {
+		PIXEL4 values = vload4(0, channel_image + id);
+		PIXEL4 result = (PIXEL4)(channel_lut[values.s0], channel_lut[values.s1], channel_lut[values.s2], channel_lut[values.s3]);
+		vstore4(result, 0, channel_output + id);
+	}
+	else {
+		for (uint i = id; i < channel_size; i++)
+			channel_output[i] = channel_lut[channel_image[i]];
+	}
+}
+
+//Same as lut_apply through images, for devices with a texture cache that copes better with the scattered LUT reads.
+//The channels are stacked into one single component (CL_R) 2D image of width x (height * channels), so dimension 1 is the row
+//and the channel is row / height. The LUT is a 1D image on top of the LUT buffer, levels values per channel.
+//8-bit images are CL_UNORM_INT8 and come back as floats in [0, 1] (v / 255 * 255 rounds back to v exactly), 16-bit ones are
+//CL_UNSIGNED_INT16 and stay integers. sizeof(PIXEL) is known when the program is built, so only one of the branches is left.
+kernel void lut_apply_image(read_only image2d_t image, write_only image2d_t output, read_only image1d_buffer_t lut, const uint height, const uint levels) {
+	const int2 position = (int2)(get_global_id(0), get_global_id(1));
+	const uint channel = position.y / height;
+
+	if (position.x < get_image_width(image)) {
+		if (sizeof(PIXEL) == 1) {
+			uint value = convert_uint_sat_rte(read_imagef(image, position).x * 255.0f);
+			write_imagef(output, position, read_imagef(lut, channel * levels + value));
+		}
+		else {
+			uint value = read_imageui(image, position).x;
+			write_imageui(output, position, read_imageui(lut, channel * levels + value));
 		}
-		barrier(CLK_GLOBAL_MEM_FENCE); //Neccesary synchronisation
 	}
 }
 
+//First bin of a cumulative histogram with any pixels in it (the last bin if the channel is empty)
+uint first_occupied_bin(global const uint* channel_histogram, const uint nr_bins) {
+	uint low = 0, high = nr_bins - 1;
+	while (low < high) {
+		uint middle = (low + high) / 2;
+		if (channel_histogram[middle] == 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
 
-//ycbcr colour image
-//for all three channels so the size of the output will be 3 * nr_bins
-//where each third is 0-255. Requires a seperate lookuptable to 
-kernel void cumulative_histogram_colour(global const unsigned char* image, global int* cumulative_histogram, const int nr_bins) {
-  const int global_id = get_global_id(0);
-  const int image_size = get_global_size(0);
+//Builds the look up table from the cumulative histogram on the device, so the whole equalisation can be queued without a round trip
+//to the host. One work item per possible pixel value (dimension 0) and channel (dimension 1), the same arithmetic as BuildLut on the host:
+//(cdf - cdf_min) * (levels - 1) / (total - cdf_min) rounded to nearest, so the first occupied bin goes to 0 and the last to levels - 1.
+//cdf_min is the count of the first occupied bin, found with a binary search since the cumulative histogram never goes down.
+//The product takes up to 32 + 16 bits, hence ulong. A channel with every pixel in one bin has nothing to spread out and keeps its values.
+kernel void lut_build(global const uint* cumulative_histogram, global PIXEL* lut, const uint nr_bins, const uint levels, const uint bin_mul, const uint bin_shift) {
+	const uint value = get_global_id(0);
+	const uint channel = get_global_id(1);
+	global const uint* channel_histogram = cumulative_histogram + channel * nr_bins;
 
-  // Calculate intensity for each channel
-  int red_intensity = input[global_id];
-  int green_intensity = input[global_id + image_size];
-  int blue_intensity = input[global_id + image_size * 2];
+	if (value < levels) {
+		const ulong cdf_min = channel_histogram[first_occupied_bin(channel_histogram, nr_bins)];
+		const ulong range = channel_histogram[nr_bins - 1] - cdf_min;
+		const ulong cdf = max((ulong)channel_histogram[to_bin(value, bin_mul, bin_shift)], cdf_min); //empty bins below the first occupied one
+		lut[channel * levels + value] = (range == 0) ? (PIXEL)value : (PIXEL)(((cdf - cdf_min) * (levels - 1) + range / 2) / range);
+	}
+}
+
+//The same look up table without a 64-bit division per entry, which is slow on most GPUs (it is done in software) and adds up
+//for 65536 entry LUTs rebuilt every frame. lut_reciprocal runs first with one work item per channel and stores 4 ulongs per channel:
+//cdf_min, range = total - cdf_min, magic = ceil(2^(63 + l) / range) with l = ceil(log2(range)), and the shift l - 1.
+//The numerators are below 2^48 (a 32-bit count times at most 65535), and range * 2^48 <= 2^(63 + l), so
+//x / range == mul_hi(x, magic) >> (l - 1) exactly for every one of them. magic always fits into 64 bits for range >= 2.
+//The magic number comes from a long division one bit at a time, about 100 steps once per channel.
+kernel void lut_reciprocal(global const uint* cumulative_histogram, global ulong* reciprocals, const uint nr_bins) {
+	const uint channel = get_global_id(0);
+	global const uint* channel_histogram = cumulative_histogram + channel * nr_bins;
 
-  // Handle edge cases for intensity values exceeding nr_bins
-  red_intensity = min(red_intensity, nr_bins - 1);
-  green_intensity = min(green_intensity, nr_bins - 1);
-  blue_intensity = min(blue_intensity, nr_bins - 1);
+	const ulong cdf_min = channel_histogram[first_occupied_bin(channel_histogram, nr_bins)];
+	const ulong range = channel_histogram[nr_bins - 1] - cdf_min;
+	uint l = 0;
+	while (((ulong)1 << l) < range)
+		l++;
 
-  // Perform atomic increments for non-cumulative histogram
-  atomic_inc(&output[red_intensity]);
-  atomic_inc(&output[green_intensity + nr_bins]);
-  atomic_inc(&output[blue_intensity + nr_bins * 2]);
+	ulong magic = 0;
+	if (range > 1) {
+		ulong remainder = 0;
+		for (int bit = 63 + l; bit >= 0; bit--) {
+			remainder = remainder * 2 + (bit == 63 + (int)l ? 1 : 0);
+			if (remainder >= range) {
+				remainder -= range;
+				if (bit < 64)
+					magic |= (ulong)1 << bit;
+			}
+		}
+		if (remainder != 0)
+			magic++;
+	}
+	reciprocals[channel * 4] = cdf_min;
+	reciprocals[channel * 4 + 1] = range;
+	reciprocals[channel * 4 + 2] = magic;
+	reciprocals[channel * 4 + 3] = l > 0 ? l - 1 : 0;
+}
 
-  // Perform Hillis-Steele scan for cumulative histogram
-  global int* swap_buffer;
-  for (int stride = 1; stride <= nr_bins; stride *= 2) {
-    output[global_id] = input[global_id];
-    output[global_id + nr_bins] = input[global_id + nr_bins];
-    output[global_id + nr_bins * 2] = input[global_id + nr_bins * 2];
+//lut_build with the reciprocals of lut_reciprocal, same output bit for bit
+kernel void lut_build_reciprocal(global const uint* cumulative_histogram, global const ulong* reciprocals, global PIXEL* lut,
+	const uint nr_bins, const uint levels, const uint bin_mul, const uint bin_shift) {
+	const uint value = get_global_id(0);
+	const uint channel = get_global_id(1);
+	global const uint* channel_histogram = cumulative_histogram + channel * nr_bins;
+	global const ulong* reciprocal = reciprocals + channel * 4;
 
-    if (global_id >= stride) {
-      output[global_id] += input[global_id - stride];
-      output[global_id + nr_bins] += input[global_id + nr_bins - stride];
-      output[global_id + nr_bins * 2] += input[global_id + (nr_bins * 2) - stride];
-    }
+	if (value < levels) {
+		const ulong cdf_min = reciprocal[0];
+		const ulong range = reciprocal[1];
+		const ulong cdf = max((ulong)channel_histogram[to_bin(value, bin_mul, bin_shift)], cdf_min);
+		const ulong x = (cdf - cdf_min) * (levels - 1) + range / 2;
+		PIXEL result;
+		if (range == 0)
+			result = (PIXEL)value;
+		else if (range == 1)
+			result = (PIXEL)x;
+		else
+			result = (PIXEL)(mul_hi(x, reciprocal[2]) >> reciprocal[3]);
+		lut[channel * levels + value] = result;
+	}
+}
 
-    barrier(CLK_GLOBAL_MEM_FENCE);
+//Batched kernels for many small images (e.g. thumbnails) in one launch instead of one launch per image.
+//The images are packed one after another (channels one after another inside each image) and offsets holds images + 1 entries,
+//image i being images[offsets[i]] up to images[offsets[i + 1]]. Dimension 1 is the slice (image * channels + channel),
+//dimension 0 strides over the pixels of the slice, so a slice gets as many work groups as the host launches along dimension 0.
+//Histograms, cumulative histograms and LUTs are kept per slice, so scan_blocked/scan_local and lut_build work on them unchanged.
+kernel void histogram_batched(global const PIXEL* images, global const uint* offsets, global uint* histogram, local uint* local_histogram,
+	const uint channels, const uint nr_bins, const uint bin_mul, const uint bin_shift) {
+	const uint slice = get_global_id(1);
+	const uint image = slice / channels;
+	const uint local_id = get_local_id(0);
+	const uint local_size = get_local_size(0);
+	const uint stride = get_global_size(0);
+	const uint channel_size = (offsets[image + 1] - offsets[image]) / channels;
+	global const PIXEL* channel_image = images + offsets[image] + (slice % channels) * channel_size;
 
-    swap_buffer = input;
-    input = output;
-    output = swap_buffer;
-  }
+	for (uint i = local_id; i < nr_bins; i += local_size)
+		local_histogram[i] = 0;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (uint i = get_global_id(0); i < channel_size; i += stride)
+		atomic_inc(&local_histogram[to_bin(channel_image[i], bin_mul, bin_shift)]);
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (uint i = local_id; i < nr_bins; i += local_size) {
+		if (local_histogram[i] != 0)
+			atomic_add(&histogram[slice * nr_bins + i], local_histogram[i]);
+	}
 }
+
+//Applies the LUT of every slice, same layout and range as histogram_batched
+kernel void lut_apply_batched(global const PIXEL* images, global PIXEL* output, global const uint* offsets, global const PIXEL* lut,
+	const uint channels, const uint levels) {
+	const uint slice = get_global_id(1);
+	const uint image = slice / channels;
+	const uint stride = get_global_size(0);
+	const uint channel_size = (offsets[image + 1] - offsets[image]) / channels;
+	const uint start = offsets[image] + (slice % channels) * channel_size;
+	global const PIXEL* slice_lut = lut + slice * levels;
+
+	for (uint i = get_global_id(0); i < channel_size; i += stride)
+		output[start + i] = slice_lut[images[start + i]];
+}
+
+//STREAM-like copy used by the benchmark to measure the peak memory bandwidth of the device, 16 bytes per work item and round.
+//The other kernels are compared against it to tell memory bound kernels from ones held back by atomics.
+kernel void stream_copy(global const uint4* input, global uint4* output, const uint size) {
+	for (uint i = get_global_id(0); i < size; i += get_global_size(0))
+		output[i] = input[i];
 }
 
+//Largest bin count handled by histogram_private, the host uses the same limit to pick the kernel
+#ifndef PRIVATE_BINS
+#define PRIVATE_BINS 32
+#endif
 
+//Small bin counts (nr_bins <= PRIVATE_BINS): every work item counts a strided run of pixels into its own private counters,
+//then the work group adds up each bin in local memory. There are no local atomics, only one global atomic per bin and work group.
+//The host launches just enough work groups to fill the device, so every work item goes through many pixels.
+kernel void histogram_private(global const PIXEL* image, global uint* histogram, local uint* scratch,
+	const uint channel_size, const uint nr_bins, const uint bin_mul, const uint bin_shift) {
+	const uint id = get_global_id(0);
+	const uint channel = get_global_id(1);
+	const uint local_id = get_local_id(0);
+	const uint local_size = get_local_size(0);
+	const uint stride = get_global_size(0);
+	global const PIXEL* channel_image = image + (size_t)channel * channel_size;
 
-//so this kernel works with 8-bit monochrome. Im pretty sure it does the exact same thing as the one above, just slightly slower and inefficient synchronisation.
-kernel void atomic_cumulative_histogram(global const unsigned char* image, global int* cumulative_histogram, const int nr_bins) {
-	const int global_id = get_global_id(0);
-	const int local_id = get_local_id(0);
+	uint counts[PRIVATE_BINS];
+	for (uint b = 0; b < PRIVATE_BINS; b++)
+		counts[b] = 0;
 
-	local uint local_hist[256]; //8bit size
-	local_hist[local_id] = 0;  // Initialize local histogram counts to zero
+	for (uint i = id; i < channel_size; i += stride)
+		counts[to_bin(channel_image[i], bin_mul, bin_shift)]++;
 
-	atomic_inc(&local_hist[image[global_id]]); //increment count 
-	barrier(CLK_LOCAL_MEM_FENCE); //synchronisation
+	//work group reduction, one bin at a time (works for any work group size)
+	for (uint b = 0; b < nr_bins; b++) {
+		scratch[local_id] = counts[b];
+		barrier(CLK_LOCAL_MEM_FENCE);
 
+		for (uint s = 1; s < local_size; s *= 2) {
+			if ((local_id % (2 * s)) == 0 && local_id + s < local_size)
+				scratch[local_id] += scratch[local_id + s];
+			barrier(CLK_LOCAL_MEM_FENCE);
+		}
 
-	uint sum = 0; //Compute the cumulative sum
-	for (int i = 0; i <= local_id; ++i) {
-		sum += local_hist[i];
+		if (local_id == 0 && scratch[0] != 0)
+			atomic_add(&histogram[channel * nr_bins + b], scratch[0]);
+		barrier(CLK_LOCAL_MEM_FENCE); //scratch is reused for the next bin
 	}
-	atomic_add(&cumulative_histogram[local_id], sum); //add the sum to corresponding bin
-	barrier(CLK_GLOBAL_MEM_FENCE);
 }
 
+//Only compiled when the host found cl_khr_subgroups or cl_intel_subgroups on the device (-DUSE_SUBGROUPS)
+#ifdef USE_SUBGROUPS
+#ifdef cl_khr_subgroups
+#pragma OPENCL EXTENSION cl_khr_subgroups : enable
+#endif
+
+//Sub-group aggregated atomics: neighbouring pixels usually fall into the same bin, so instead of one atomic_inc per work item
+//the sub-group picks the smallest bin that is still pending, counts how many of its work items want it
+//and only the first of them (the leader) adds the whole count. Each round removes at least one distinct bin.
+kernel void histogram_subgroup(global const PIXEL* image, global uint* histogram, local uint* local_histogram,
+	const uint channel_size, const uint nr_bins, const uint bin_mul, const uint bin_shift) {
+	const uint channel = get_global_id(1);
+	const uint local_id = get_local_id(0);
+	const uint local_size = get_local_size(0);
+	const uint lane = get_sub_group_local_id();
+	global const PIXEL* channel_image = image + (size_t)channel * channel_size;
 
+	for (uint i = local_id; i < nr_bins; i += local_size)
+		local_histogram[i] = 0;
+	barrier(CLK_LOCAL_MEM_FENCE);
 
+	//the loop start is the same for the whole work group so every work item runs the same number of rounds,
+	//work items past the end of the image have nothing to count but still take part in the sub-group functions
+	for (uint start = get_group_id(0) * local_size; start < channel_size; start += get_global_size(0)) {
+		uint i = start + local_id;
+		uint bin = (i < channel_size) ? to_bin(channel_image[i], bin_mul, bin_shift) : UINT_MAX;
 
+		while (true) {
+			uint current = sub_group_reduce_min(bin); //same value on every work item, so the loop is uniform
+			if (current == UINT_MAX)
+				break;
+			uint match = (bin == current) ? 1 : 0;
+			uint count = sub_group_reduce_add(match);
+			uint leader = sub_group_reduce_min(match ? lane : UINT_MAX);
+			if (lane == leader)
+				atomic_add(&local_histogram[current], count);
+			if (match)
+				bin = UINT_MAX;
+		}
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
 
+	//partial to global
+	for (uint i = local_id; i < nr_bins; i += local_size) {
+		if (local_histogram[i] != 0)
+			atomic_add(&histogram[channel * nr_bins + i], local_histogram[i]);
+	}
+}
+#endif
@@ -0,0 +1,18 @@
+# Turns a text file into a C++ header with its contents as a null terminated char array, e.g. for kernels.cl:
+#   cmake -DINPUT=kernels.cl -DOUTPUT=kernels_cl.h -DNAME=kernels_cl -P EmbedFile.cmake
+# A byte array instead of a string literal because MSVC limits the length of string literals.
+
+file(READ "${INPUT}" content HEX)
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," content "${content}")
+# 16 bytes per line (CMake regular expressions have no {n} repetition)
+string(REPEAT "0x[0-9a-f][0-9a-f]," 16 line)
+string(REGEX REPLACE "(${line})" "\\1\n\t" content "${content}")
+
+get_filename_component(input_name "${INPUT}" NAME)
+file(WRITE "${OUTPUT}.tmp"
+	"#pragma once\n\n"
+	"//Generated from ${input_name} by EmbedFile.cmake, do not edit\n"
+	"static const char ${NAME}[] = {\n\t${content}0x00\n};\n")
+# only touch the header when the contents change so dependent files are not rebuilt for nothing
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different "${OUTPUT}.tmp" "${OUTPUT}")
+file(REMOVE "${OUTPUT}.tmp")
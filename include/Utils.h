@@ -24,13 +24,13 @@ ostream& operator<< (ostream& out, const vector<T>& v) {
 	return out;
 }
 
-string GetPlatformName(int platform_id) {
+inline string GetPlatformName(int platform_id) {
 	vector<cl::Platform> platforms;
 	cl::Platform::get(&platforms);
 	return platforms[platform_id].getInfo<CL_PLATFORM_NAME>();
 }
 
-string GetDeviceName(int platform_id, int device_id) {
+inline string GetDeviceName(int platform_id, int device_id) {
 	vector<cl::Platform> platforms;
 	cl::Platform::get(&platforms);
 	vector<cl::Device> devices;
@@ -38,7 +38,7 @@ string GetDeviceName(int platform_id, int device_id) {
 	return devices[device_id].getInfo<CL_DEVICE_NAME>();
 }
 
-const char *getErrorString(cl_int error) {
+inline const char *getErrorString(cl_int error) {
 	switch (error){
 		// run-time and JIT compiler errors
 	case 0: return "CL_SUCCESS";
@@ -114,21 +114,23 @@ const char *getErrorString(cl_int error) {
 	}
 }
 
-void CheckError(cl_int error) {
+inline void CheckError(cl_int error) {
 	if (error != CL_SUCCESS) {
 		cerr << "OpenCL call failed with error " << getErrorString(error) << endl;
 		exit(1);
 	}
 }
 
-void AddSources(cl::Program::Sources& sources, const string& file_name) {
-	//TODO: add file existence check
+inline void AddSources(cl::Program::Sources& sources, const string& file_name) {
 	ifstream file(file_name);
-	string* source_code = new string(istreambuf_iterator<char>(file), (istreambuf_iterator<char>()));
-	sources.push_back((*source_code).c_str());
+	if (!file.is_open()) {
+		cerr << "Unable to open kernel file " << file_name << endl;
+		throw cl::Error(CL_INVALID_PROGRAM, "AddSources: kernel file not found");
+	}
+	sources.push_back(string(istreambuf_iterator<char>(file), (istreambuf_iterator<char>())));
 }
 
-string ListPlatformsDevices() {
+inline string ListPlatformsDevices() {
 
 	stringstream sstream;
 	vector<cl::Platform> platforms;
@@ -178,7 +180,7 @@ string ListPlatformsDevices() {
 	return sstream.str();
 }
 
-cl::Context GetContext(int platform_id, int device_id) {
+inline cl::Context GetContext(int platform_id, int device_id) {
 	vector<cl::Platform> platforms;
 
 	cl::Platform::get(&platforms);
@@ -198,6 +200,42 @@ cl::Context GetContext(int platform_id, int device_id) {
 	return cl::Context();
 }
 
+//Context with every device of a platform, for splitting the work across devices
+inline cl::Context GetPlatformContext(int platform_id) {
+	vector<cl::Platform> platforms;
+	cl::Platform::get(&platforms);
+
+	vector<cl::Device> devices;
+	platforms[platform_id].getDevices((cl_device_type)CL_DEVICE_TYPE_ALL, &devices);
+
+	return cl::Context(devices);
+}
+
+//Device fission: splits a device (normally a multi-socket CPU) into one sub-device per NUMA node.
+//Devices that cannot be partitioned by NUMA node (GPUs, single socket machines, OpenCL 1.1) come back unchanged.
+inline vector<cl::Device> GetNumaSubDevices(cl::Device device) {
+	vector<cl::Device> sub_devices;
+	try {
+		if ((device.getInfo<CL_DEVICE_PARTITION_AFFINITY_DOMAIN>() & CL_DEVICE_AFFINITY_DOMAIN_NUMA) == 0)
+			return { device };
+		const cl_device_partition_property properties[] = { CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, CL_DEVICE_AFFINITY_DOMAIN_NUMA, 0 };
+		device.createSubDevices(properties, &sub_devices);
+	}
+	catch (const cl::Error&) {
+		return { device };
+	}
+	return sub_devices.empty() ? vector<cl::Device>{ device } : sub_devices;
+}
+
+//One context per NUMA node of the selected device, so buffers created in a context are allocated on the memory of its node
+inline vector<cl::Context> GetNumaContexts(int platform_id, int device_id) {
+	cl::Context context = GetContext(platform_id, device_id);
+	vector<cl::Context> contexts;
+	for (const cl::Device& sub_device : GetNumaSubDevices(context.getInfo<CL_CONTEXT_DEVICES>()[0]))
+		contexts.push_back(cl::Context({ sub_device }));
+	return contexts;
+}
+
 enum ProfilingResolution {
 	PROF_NS = 1,
 	PROF_US = 1000,
@@ -205,7 +243,7 @@ enum ProfilingResolution {
 	PROF_S = 1000000000
 };
 
-string GetFullProfilingInfo(const cl::Event& evnt, ProfilingResolution resolution) {
+inline string GetFullProfilingInfo(const cl::Event& evnt, ProfilingResolution resolution) {
 	stringstream sstream;
 
 	sstream << "Queued " << (evnt.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>() - evnt.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>()) / resolution;